@@ -0,0 +1,118 @@
+//
+// Pinning of simulation threads to CPUs, NUMA node by NUMA node.
+//
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include "affinity.h"
+
+/* Where the kernel lists the CPUs of each NUMA node, as node<N>/cpulist
+ */
+#define NUMA_SYSFS "/sys/devices/system/node"
+
+static pthread_once_t cpus_once = PTHREAD_ONCE_INIT;
+static int cpus[CPU_SETSIZE];   /* CPUs to pin threads to, NUMA node by NUMA node */
+static int num_cpus;
+
+/* Add the allowed CPUs of a list such as "0-3,8,10-11" to the CPUs to pin threads to, in order
+ * @params:
+ *   list: CPU list
+ *   allowed: CPUs the program may run on, the added ones are taken out
+ * @returns:
+ *   none
+ */
+static void add_cpus(const char *list, cpu_set_t *allowed) {
+    while (*list) {
+        char *end;
+        int lo = (int) strtol(list, &end, 10);
+        int hi = lo;
+        if (end == list) {
+            return;
+        }
+        if (*end == '-') {
+            list = end + 1;
+            hi = (int) strtol(list, &end, 10);
+        }
+        for (int cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++) {
+            if (cpu >= 0 && CPU_ISSET(cpu, allowed)) {
+                cpus[num_cpus++] = cpu;
+                CPU_CLR(cpu, allowed);
+            }
+        }
+        list = *end == ',' ? end + 1 : end + strlen(end);
+    }
+}
+
+/* Order the CPUs the program may run on by NUMA node, those the kernel does not place on a node last
+ * @params:
+ *   none
+ * @returns:
+ *   none
+ */
+static void cpus_init() {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        return;
+    }
+
+    DIR *dir = opendir(NUMA_SYSFS);
+    if (dir) {
+        /* Go through the nodes in order of their numbers, which readdir does not guarantee
+         */
+        int max_node = -1;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            int node;
+            if (sscanf(entry->d_name, "node%d", &node) == 1 && node > max_node) {
+                max_node = node;
+            }
+        }
+        closedir(dir);
+
+        for (int node = 0; node <= max_node; node++) {
+            char path[64];
+            char list[4096];
+            snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/cpulist", node);
+            FILE *f = fopen(path, "r");
+            if (f) {
+                if (fgets(list, sizeof(list), f)) {
+                    list[strcspn(list, "\n")] = '\0';
+                    add_cpus(list, &allowed);
+                }
+                fclose(f);
+            }
+        }
+    }
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus[num_cpus++] = cpu;
+        }
+    }
+}
+
+/* Pin the calling thread to one of the CPUs the program may run on.  The CPUs are taken NUMA node by NUMA node,
+ * so that threads with nearby indexes share a NUMA node.  A node's trace buffer, and the arena blocks it allocates
+ * while it is simulated, are first touched by the thread simulating it and stay on that thread's NUMA node.  Its
+ * queues, inbox and first arena block are set up by process_init, and are placed by the thread that called it.
+ * @params:
+ *   index: index of the thread, the CPUs are handed out round-robin
+ * @returns:
+ *   1 on success, 0 if the thread could not be pinned
+ */
+extern int affinity_pin(int index) {
+    pthread_once(&cpus_once, cpus_init);
+    if (num_cpus == 0) {
+        return 0;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[index % num_cpus], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
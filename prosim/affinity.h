@@ -0,0 +1,19 @@
+//
+// Pinning of simulation threads to CPUs, NUMA node by NUMA node.
+//
+
+#ifndef PROSIM_AFFINITY_H
+#define PROSIM_AFFINITY_H
+
+/* Pin the calling thread to one of the CPUs the program may run on.  The CPUs are taken NUMA node by NUMA node,
+ * so that threads with nearby indexes share a NUMA node.  A node's trace buffer, and the arena blocks it allocates
+ * while it is simulated, are first touched by the thread simulating it and stay on that thread's NUMA node.  Its
+ * queues, inbox and first arena block are set up by process_init, and are placed by the thread that called it.
+ * @params:
+ *   index: index of the thread, the CPUs are handed out round-robin
+ * @returns:
+ *   1 on success, 0 if the thread could not be pinned
+ */
+extern int affinity_pin(int index);
+
+#endif //PROSIM_AFFINITY_H
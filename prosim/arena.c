@@ -0,0 +1,178 @@
+//
+// Bump allocator for objects that live until the end of a run.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "arena.h"
+
+/* Blocks start small and double in size up to a limit
+ */
+#define BLOCK_MIN (64 * 1024)
+#define BLOCK_MAX (4 * 1024 * 1024)
+
+/* Alignment of every allocation
+ */
+#define ALIGN 16
+
+/* Initialize an empty arena
+ * @params:
+ *   arena: arena to initialize
+ * @returns:
+ *   none
+ */
+extern void arena_init(arena_t *arena) {
+    memset(arena, 0, sizeof(arena_t));
+}
+
+/* Allocates zeroed memory from the arena, aligned for any type.
+ * A NULL arena allocates from the heap with calloc instead.
+ * @params:
+ *   arena: arena to allocate from, or NULL
+ *   size: number of bytes to allocate
+ * @returns:
+ *   pointer to the memory, crashes if out of memory
+ */
+extern void *arena_alloc(arena_t *arena, size_t size) {
+    if (arena == NULL) {
+        void *mem = calloc(1, size);
+        assert(mem);
+        return mem;
+    }
+    return arena_alloc_aligned(arena, size, ALIGN);
+}
+
+/* Allocates zeroed memory from the arena with a stricter alignment than arena_alloc's.
+ * A NULL arena allocates from the heap with aligned_alloc instead.
+ * @params:
+ *   arena: arena to allocate from, or NULL
+ *   size: number of bytes to allocate
+ *   align: alignment, a power of two
+ * @returns:
+ *   pointer to the memory, crashes if out of memory
+ */
+extern void *arena_alloc_aligned(arena_t *arena, size_t size, size_t align) {
+    if (arena == NULL) {
+        void *mem = aligned_alloc(align, (size + align - 1) & ~(align - 1));
+        assert(mem);
+        memset(mem, 0, size);
+        return mem;
+    }
+
+    arena_block_t *block = arena->head;
+    size_t pad = block ? -(uintptr_t) (block->data + block->used) & (align - 1) : 0;
+
+    /* Start a new block if the current one is full.  Requests too large for a regular block
+     * get a block of their own, which is put behind the current block so it stays in use.
+     */
+    if (block == NULL || block->size - block->used < pad + size) {
+        if (arena->block_size == 0) {
+            arena->block_size = BLOCK_MIN;
+        }
+        int own = size + align > arena->block_size;
+        size_t block_size = own ? size + align : arena->block_size;
+
+        block = malloc(sizeof(arena_block_t) + block_size);
+        assert(block);
+        block->size = block_size;
+        block->used = 0;
+        if (own && arena->head) {
+            block->next = arena->head->next;
+            arena->head->next = block;
+            if (arena->tail == arena->head) {
+                arena->tail = block;
+            }
+        } else {
+            block->next = arena->head;
+            arena->head = block;
+            if (arena->tail == NULL) {
+                arena->tail = block;
+            }
+            if (!own && arena->block_size < BLOCK_MAX) {
+                arena->block_size *= 2;
+            }
+        }
+        arena->blocks++;
+        arena->reserved += sizeof(arena_block_t) + block_size;
+        pad = -(uintptr_t) block->data & (align - 1);
+    }
+
+    void *mem = block->data + block->used + pad;
+    block->used += pad + size;
+    arena->used += size;
+    if (arena->used > arena->peak) {
+        arena->peak = arena->used;
+    }
+    memset(mem, 0, size);
+    return mem;
+}
+
+/* Moves all the memory of one arena into another, so it is freed with the other arena
+ * @params:
+ *   dst: arena that takes over the memory
+ *   src: arena giving up its memory, left empty
+ * @returns:
+ *   none
+ */
+extern void arena_adopt(arena_t *dst, arena_t *src) {
+    if (src->head == NULL) {
+        return;
+    }
+
+    /* Splice the source blocks in behind the destination's current block,
+     * so that the destination keeps handing out memory from the same block.
+     */
+    if (dst->head == NULL) {
+        dst->head = src->head;
+        dst->tail = src->tail;
+    } else {
+        src->tail->next = dst->head->next;
+        dst->head->next = src->head;
+        if (dst->tail == dst->head) {
+            dst->tail = src->tail;
+        }
+    }
+    dst->blocks += src->blocks;
+    dst->used += src->used;
+    dst->reserved += src->reserved;
+    if (dst->used > dst->peak) {
+        dst->peak = dst->used;
+    }
+
+    size_t peak = src->peak;
+    arena_init(src);
+    src->peak = peak;
+}
+
+/* Frees all the memory handed out by the arena, the arena can be reused afterwards
+ * @params:
+ *   arena: arena to free
+ * @returns:
+ *   none
+ */
+extern void arena_free_all(arena_t *arena) {
+    while (arena->head) {
+        arena_block_t *block = arena->head;
+        arena->head = block->next;
+        free(block);
+    }
+
+    size_t peak = arena->peak;
+    arena_init(arena);
+    arena->peak = peak;
+}
+
+/* Outputs the peak memory use of the arena
+ * @params:
+ *   arena: arena to report on
+ *   name: name of the arena
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void arena_report(arena_t *arena, const char *name, FILE *fout) {
+    fprintf(fout, "arena %-12s peak %zu bytes, %zu bytes in %d blocks\n", name, arena->peak,
+            arena->reserved, arena->blocks);
+}
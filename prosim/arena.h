@@ -0,0 +1,92 @@
+//
+// Bump allocator for objects that live until the end of a run.
+//
+
+#ifndef PROSIM_ARENA_H
+#define PROSIM_ARENA_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Size of a cache line.  Data written by one thread is aligned to it when other threads touch data next to it,
+ * so that the line does not bounce between the threads' cores.
+ */
+#define CACHE_LINE 64
+
+typedef struct arena_block {
+    struct arena_block *next;   /* next block in the arena */
+    size_t size;                /* number of bytes in data */
+    size_t used;                /* number of bytes of data handed out */
+    char data[];                /* memory handed out by the arena */
+} arena_block_t;
+
+/* An arena hands out memory from large blocks and frees it all at once.
+ * An arena is not thread-safe, each arena is only used by one thread at a time.
+ */
+typedef struct arena {
+    arena_block_t *head;        /* block currently being handed out */
+    arena_block_t *tail;        /* oldest block */
+    int blocks;                 /* number of blocks */
+    size_t block_size;          /* size of the next block, doubles up to a limit */
+    size_t used;                /* number of bytes handed out */
+    size_t peak;                /* largest number of bytes handed out at one time */
+    size_t reserved;            /* number of bytes allocated for blocks */
+} arena_t;
+
+/* Initialize an empty arena
+ * @params:
+ *   arena: arena to initialize
+ * @returns:
+ *   none
+ */
+extern void arena_init(arena_t *arena);
+
+/* Allocates zeroed memory from the arena, aligned for any type.
+ * A NULL arena allocates from the heap with calloc instead.
+ * @params:
+ *   arena: arena to allocate from, or NULL
+ *   size: number of bytes to allocate
+ * @returns:
+ *   pointer to the memory, crashes if out of memory
+ */
+extern void *arena_alloc(arena_t *arena, size_t size);
+
+/* Allocates zeroed memory from the arena with a stricter alignment than arena_alloc's.
+ * A NULL arena allocates from the heap with aligned_alloc instead.
+ * @params:
+ *   arena: arena to allocate from, or NULL
+ *   size: number of bytes to allocate
+ *   align: alignment, a power of two
+ * @returns:
+ *   pointer to the memory, crashes if out of memory
+ */
+extern void *arena_alloc_aligned(arena_t *arena, size_t size, size_t align);
+
+/* Moves all the memory of one arena into another, so it is freed with the other arena
+ * @params:
+ *   dst: arena that takes over the memory
+ *   src: arena giving up its memory, left empty
+ * @returns:
+ *   none
+ */
+extern void arena_adopt(arena_t *dst, arena_t *src);
+
+/* Frees all the memory handed out by the arena, the arena can be reused afterwards
+ * @params:
+ *   arena: arena to free
+ * @returns:
+ *   none
+ */
+extern void arena_free_all(arena_t *arena);
+
+/* Outputs the peak memory use of the arena
+ * @params:
+ *   arena: arena to report on
+ *   name: name of the arena
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void arena_report(arena_t *arena, const char *name, FILE *fout);
+
+#endif //PROSIM_ARENA_H
@@ -0,0 +1,292 @@
+//
+// End-to-end benchmark running prosim over a grid of generated workloads.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* Largest number of grid points and of extra prosim arguments
+ */
+#define POINTS_MAX 64
+#define ARGS_MAX 32
+
+/* A workload size to benchmark
+ */
+typedef struct point {
+    int nodes;
+    int procs;          /* processes per node */
+} point_t;
+
+/* The quick grid, run by default
+ */
+static const point_t GRID_SMALL[] = {
+        {1, 1000}, {4, 1000}, {16, 1000}, {64, 1000}, {256, 100}, {1024, 10}
+};
+
+/* The full grid, up to millions of processes and thousands of nodes
+ */
+static const point_t GRID_LARGE[] = {
+        {1, 1000}, {16, 1000}, {256, 1000}, {1, 1000000}, {16, 100000}, {1024, 1000}, {4096, 500}
+};
+
+/* Hardware events counted over each prosim run, reported as null where the kernel or hardware
+ * does not offer them
+ */
+static const struct {
+    const char *name;
+    unsigned long long config;
+} COUNTERS[] = {
+        {"cache_references", PERF_COUNT_HW_CACHE_REFERENCES},
+        {"cache_misses", PERF_COUNT_HW_CACHE_MISSES},
+        {"instructions", PERF_COUNT_HW_INSTRUCTIONS}
+};
+#define NUM_COUNTERS ((int) (sizeof(COUNTERS) / sizeof(COUNTERS[0])))
+
+/* Print the command line options
+ * @params:
+ *   prog: name of the executable
+ * @returns:
+ *   none
+ */
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [options] [-- prosim options]\n"
+                    "Writes one JSON object per workload size on stdout, with hardware cache counts where available.\n"
+                    "  --prosim PATH    simulator to run (default ./prosim)\n"
+                    "  --gen PATH       workload generator (default ./prosim-gen)\n"
+                    "  --grid small|large  sizes to run (default small)\n"
+                    "  --point N:P      run N nodes with P processes each instead of a grid, may be repeated\n"
+                    "  --seed N         seed passed to the generator (default 1)\n", prog);
+}
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Run a program with its stdin and stdout redirected
+ * @params:
+ *   argv: program and its arguments
+ *   in: file descriptor for stdin
+ *   out: file descriptor for stdout
+ *   gate: file descriptor from which the child reads a byte before running the program, or -1
+ * @returns:
+ *   the child's pid, or -1 if it could not be started
+ */
+static pid_t spawn(char **argv, int in, int out, int gate) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        char go;
+        if (gate >= 0 && read(gate, &go, 1) != 1) {
+            _exit(127);
+        }
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        execv(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    return pid;
+}
+
+/* Generate the workload of a grid point into a temporary file
+ * @params:
+ *   gen: path of the generator
+ *   pt: workload size
+ *   seed: generator seed
+ * @returns:
+ *   file descriptor of the workload, positioned at its start, or -1 on failure
+ */
+static int generate(char *gen, const point_t *pt, char *seed) {
+    char nodes[16], procs[16];
+    char path[] = "/tmp/prosim-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("workload");
+        return -1;
+    }
+    unlink(path);
+
+    snprintf(nodes, sizeof(nodes), "%d", pt->nodes);
+    snprintf(procs, sizeof(procs), "%d", pt->procs);
+    char *argv[] = {gen, "--nodes", nodes, "--procs", procs, "--seed", seed, NULL};
+
+    int status;
+    pid_t pid = spawn(argv, STDIN_FILENO, fd, -1);
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        close(fd);
+        return -1;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/* Count a hardware event in a process and the threads it starts, from the time it calls exec
+ * @params:
+ *   pid: process to count in
+ *   config: PERF_COUNT_HW_* event
+ * @returns:
+ *   file descriptor of the counter, or -1 if the event cannot be counted
+ */
+static int open_counter(pid_t pid, unsigned long long config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.enable_on_exec = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, pid, -1, -1, 0);
+}
+
+/* Run prosim on a workload, counting the trace lines it writes, and report the run as JSON
+ * @params:
+ *   argv: prosim and its arguments
+ *   pt: workload size
+ *   workload: file descriptor of the workload
+ * @returns:
+ *   1 if prosim succeeded, 0 otherwise
+ */
+static int run(char **argv, const point_t *pt, int workload) {
+    static char block[1 << 16];
+    int fds[2];
+    long long events = 0;
+    int line_start = 1;
+    struct rusage usage;
+    int status;
+    int gate[2];
+    int counters[NUM_COUNTERS];
+
+    if (pipe(fds) < 0 || pipe(gate) < 0) {
+        perror("pipe");
+        return 0;
+    }
+
+    /* Hold the child back until its counters are open, so that they see all of prosim
+     */
+    fcntl(gate[1], F_SETFD, FD_CLOEXEC);
+    pid_t pid = spawn(argv, workload, fds[1], gate[0]);
+    close(fds[1]);
+    close(gate[0]);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        counters[i] = pid < 0 ? -1 : open_counter(pid, COUNTERS[i].config);
+    }
+    double start = now_s();
+    if (write(gate[1], "", 1) != 1) {
+        perror("gate");
+    }
+    close(gate[1]);
+
+    /* Every trace line is one simulated event, the statistics lines start with '|'
+     */
+    ssize_t n;
+    while ((n = read(fds[0], block, sizeof(block))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            events += line_start && block[i] == '[';
+            line_start = block[i] == '\n';
+        }
+    }
+    close(fds[0]);
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+        return 0;
+    }
+    double wall = now_s() - start;
+    int ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    printf("{\"nodes\": %d, \"procs_per_node\": %d, \"processes\": %lld, \"events\": %lld, "
+           "\"wall_s\": %.6f, \"events_per_s\": %.0f, \"peak_rss_kb\": %ld, ",
+           pt->nodes, pt->procs, (long long) pt->nodes * pt->procs, events,
+           wall, wall > 0 ? events / wall : 0, usage.ru_maxrss);
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        unsigned long long count;
+        if (counters[i] >= 0 && read(counters[i], &count, sizeof(count)) == sizeof(count)) {
+            printf("\"%s\": %llu, ", COUNTERS[i].name, count);
+        } else {
+            printf("\"%s\": null, ", COUNTERS[i].name);
+        }
+        if (counters[i] >= 0) {
+            close(counters[i]);
+        }
+    }
+    printf("\"ok\": %s}\n", ok ? "true" : "false");
+    fflush(stdout);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    char *prosim = "./prosim";
+    char *gen = "./prosim-gen";
+    char *seed = "1";
+    const point_t *grid = GRID_SMALL;
+    int grid_len = sizeof(GRID_SMALL) / sizeof(GRID_SMALL[0]);
+    point_t points[POINTS_MAX];
+    int num_points = 0;
+    char *prosim_argv[ARGS_MAX + 2];
+    int prosim_argc = 1;
+
+    /* Process the command line options, everything after "--" is passed on to prosim
+     */
+    int i;
+    for (i = 1; i < argc && strcmp(argv[i], "--"); i++) {
+        if (!strcmp(argv[i], "--prosim") && i + 1 < argc) {
+            prosim = argv[++i];
+        } else if (!strcmp(argv[i], "--gen") && i + 1 < argc) {
+            gen = argv[++i];
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = argv[++i];
+        } else if (!strcmp(argv[i], "--grid") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "small")) {
+                grid = GRID_SMALL;
+                grid_len = sizeof(GRID_SMALL) / sizeof(GRID_SMALL[0]);
+            } else if (!strcmp(argv[i], "large")) {
+                grid = GRID_LARGE;
+                grid_len = sizeof(GRID_LARGE) / sizeof(GRID_LARGE[0]);
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--point") && i + 1 < argc && num_points < POINTS_MAX &&
+                   sscanf(argv[i + 1], "%d:%d", &points[num_points].nodes, &points[num_points].procs) == 2 &&
+                   points[num_points].nodes > 0 && points[num_points].procs > 0) {
+            num_points++;
+            i++;
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    for (i++; i < argc && prosim_argc <= ARGS_MAX; i++) {
+        prosim_argv[prosim_argc++] = argv[i];
+    }
+    prosim_argv[0] = prosim;
+    prosim_argv[prosim_argc] = NULL;
+
+    if (num_points > 0) {
+        grid = points;
+        grid_len = num_points;
+    }
+
+    int failed = 0;
+    for (int p = 0; p < grid_len; p++) {
+        int workload = generate(gen, &grid[p], seed);
+        if (workload < 0) {
+            fprintf(stderr, "%s failed for %d nodes with %d processes each\n", gen, grid[p].nodes, grid[p].procs);
+            return -1;
+        }
+        failed |= !run(prosim_argv, &grid[p], workload);
+        close(workload);
+    }
+    return failed ? -1 : 0;
+}
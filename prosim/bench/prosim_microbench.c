@@ -0,0 +1,404 @@
+//
+// Microbenchmarks of the simulator's hot paths: the priority queues, context_next_op and node_simulate.
+// Each case is run a few times to warm up, then timed over a number of repetitions, and the median and
+// percentiles of the time per operation across the repetitions are reported, so that a change to
+// prio_q.c, context.c or process.c can be compared against the previous build.  Build with optimizations,
+// e.g., CMAKE_BUILD_TYPE=Release or "make prosim-microbench", for numbers that mean something.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <assert.h>
+#include "../prosim.h"
+
+/* Largest number of cases
+ */
+#define CASES_MAX 64
+
+/* Operations timed in each repetition of a case, at least, so that the clock's resolution does not matter
+ */
+#define OPS_PER_REP 200000
+
+/* Remove/add pairs timed on the queues where an add costs O(n), the list's longer than SLOW_ITEMS
+ */
+#define SLOW_ITEMS 1000
+#define SLOW_PAIRS 1000
+
+/* Priority distributions of the queue cases
+ */
+enum {
+    DIST_UNIFORM = 0,   /* random priorities, spread over as many values as there are items */
+    DIST_ASCENDING,     /* increasing priorities, every item goes to the tail, as in FIFO ready queues */
+    DIST_DESCENDING,    /* decreasing priorities, every item goes to the head */
+    DIST_EQUAL,         /* a single priority, the ties are broken in insertion order */
+    DIST_HOLD,          /* the classic hold model: remove the head and add it back a random distance later */
+    DIST_COUNT
+};
+
+static const char *DIST_NAMES[] = {"uniform", "ascending", "descending", "equal", "hold"};
+static const char *IMPL_NAMES[] = {"heap", "list"};
+
+/* A benchmark case, the meaning of its parameters depends on its function
+ */
+typedef struct bench_case {
+    char name[48];
+    /* Run one repetition, returning the nanoseconds spent in the timed part and storing the number of
+     * operations it performed
+     */
+    double (*run)(const struct bench_case *bc, long long *ops);
+    int a;
+    int b;
+    int c;
+} bench_case_t;
+
+/* Print the command line options
+ * @params:
+ *   prog: name of the executable
+ * @returns:
+ *   none
+ */
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n"
+                    "Times the priority queues, context_next_op and node_simulate, and reports the median and the\n"
+                    "10th and 90th percentiles of the time per operation across repetitions of each case.\n"
+                    "  --reps N         timed repetitions of each case (default 21)\n"
+                    "  --warmup N       untimed repetitions run first (default 3)\n"
+                    "  --filter TEXT    only run the cases whose name contains TEXT\n"
+                    "  --list           list the cases instead of running them\n"
+                    "  --json           write one JSON object per case instead of a table\n", prog);
+}
+
+/* Small xorshift generator so that every repetition sees the same priorities and programs
+ */
+static unsigned int rng_state;
+
+static void rng_seed() {
+    rng_state = 2463534242u;
+}
+
+static unsigned int rng_next() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Fill a queue with n items and empty it again, or with DIST_HOLD keep it at n items through n remove/add pairs,
+ * over as many rounds as it takes to reach OPS_PER_REP adds and removes.  Uniform and hold adds to a list of more
+ * than SLOW_ITEMS are O(n), so those cases only time SLOW_PAIRS remove/add pairs on the full queue.
+ * @params:
+ *   bc: case, with a the implementation, b the distribution and c the number of items
+ *   ops: where to store the number of adds and removes
+ * @returns:
+ *   nanoseconds spent in the adds and removes
+ */
+static double run_prio_q(const bench_case_t *bc, long long *ops) {
+    static int item;
+    int n = bc->c;
+    int slow = bc->a == PRIO_Q_LIST && n > SLOW_ITEMS && (bc->b == DIST_UNIFORM || bc->b == DIST_HOLD);
+    int pairs = slow ? SLOW_PAIRS : n;
+    int rounds = OPS_PER_REP / (2 * n) > 0 ? OPS_PER_REP / (2 * n) : 1;
+    int *prio = malloc(n * sizeof(int));
+    arena_t arena;
+    assert(prio);
+
+    rng_seed();
+    for (int i = 0; i < n; i++) {
+        switch (bc->b) {
+            case DIST_UNIFORM:
+            case DIST_HOLD:
+                prio[i] = (int) (rng_next() % n);
+                break;
+            case DIST_ASCENDING:
+                prio[i] = i;
+                break;
+            case DIST_DESCENDING:
+                prio[i] = n - i;
+                break;
+            default:
+                prio[i] = 0;
+        }
+    }
+
+    arena_init(&arena);
+    prio_q_set_impl(bc->a);
+    prio_q_t *q = prio_q_new_in(&arena);
+    double elapsed = 0;
+    for (int r = 0; r < rounds; r++) {
+        if (bc->b == DIST_HOLD || slow) {
+            /* Only the remove/add pairs are timed, the queue is filled in priority order
+             */
+            for (int i = 0; i < n; i++) {
+                prio_q_add(q, &item, i);
+            }
+            int base = n;
+            double start = now_ns();
+            for (int i = 0; i < pairs; i++) {
+                prio_q_remove(q);
+                prio_q_add(q, &item, bc->b == DIST_HOLD ? base++ + prio[i] : prio[i]);
+            }
+            elapsed += now_ns() - start;
+            while (!prio_q_empty(q)) {
+                prio_q_remove(q);
+            }
+        } else {
+            double start = now_ns();
+            for (int i = 0; i < n; i++) {
+                prio_q_add(q, &item, prio[i]);
+            }
+            while (!prio_q_empty(q)) {
+                prio_q_remove(q);
+            }
+            elapsed += now_ns() - start;
+        }
+    }
+    prio_q_set_impl(PRIO_Q_HEAP);
+    arena_free_all(&arena);
+    free(prio);
+
+    *ops = 2LL * pairs * rounds;
+    return elapsed;
+}
+
+/* Run a program of nested LOOPs around a single DOOP to completion, one context_next_op call per DOOP
+ * @params:
+ *   bc: case, with a the nesting depth and b the iterations of each LOOP
+ *   ops: where to store the number of context_next_op calls
+ * @returns:
+ *   nanoseconds spent in context_next_op
+ */
+static double run_next_op(const bench_case_t *bc, long long *ops) {
+    int depth = bc->a;
+    int size = 2 * depth + 2;
+    opcode *code = malloc(size * sizeof(opcode));
+    assert(code);
+    for (int i = 0; i < depth; i++) {
+        code[i] = (opcode) {OP_LOOP, bc->b};
+        code[depth + 1 + i] = (opcode) {OP_END, 0};
+    }
+    code[depth] = (opcode) {OP_DOOP, 1};
+    code[size - 1] = (opcode) {OP_HALT, 0};
+
+    program *prog = program_intern(code, size, "nested");
+    assert(prog);
+    context *cur = context_create(NULL, "nested", prog, 0, 1);
+    long long calls = 0;
+    double elapsed = 0;
+    do {
+        context_reuse(cur, "nested", prog, 0, 1);
+        double start = now_ns();
+        while (context_next_op(cur) == 1) {
+            calls++;
+        }
+        elapsed += now_ns() - start;
+        calls++;
+    } while (calls < OPS_PER_REP);
+    free(cur->cold);
+    free(cur);
+    free(code);
+
+    *ops = calls;
+    return elapsed;
+}
+
+/* Count the state transitions handed to the sink
+ */
+static void count_events(void *arg, const trace_entry_t *entries, int count) {
+    (void) entries;
+    *(long long *) arg += count;
+}
+
+/* Simulate a synthetic node to completion with node_simulate.  Each process loops over a DOOP and a BLOCK of
+ * random lengths, with a random priority, and the processes arrive a few ticks apart.
+ * @params:
+ *   bc: case, with a the number of processes, b the number of CPUs and c the scheduling policy
+ *   ops: where to store the number of state transitions
+ * @returns:
+ *   nanoseconds spent in node_simulate
+ */
+static double run_node(const bench_case_t *bc, long long *ops) {
+    long long events = 0;
+    sim_t *sim = process_init(5, 1);
+    process_set_cpus(sim, 1, bc->b);
+    process_set_policy(sim, bc->c);
+    process_set_events(sim, count_events, &events);
+
+    rng_seed();
+    for (int i = 0; i < bc->a; i++) {
+        opcode code[] = {{OP_LOOP, 10}, {OP_DOOP, 1 + (int) (rng_next() % 20)},
+                         {OP_BLOCK, 1 + (int) (rng_next() % 50)}, {OP_END, 0}, {OP_HALT, 0}};
+        context *proc = process_create(sim, "synth", code, 5, (int) (rng_next() % 10), 1, i * 3);
+        assert(proc);
+        process_submit(sim, proc);
+    }
+    process_submit_done(sim);
+
+    double start = now_ns();
+    node_simulate(sim, 1);
+    double elapsed = now_ns() - start;
+    process_free(sim);
+
+    *ops = events;
+    return elapsed;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return x < y ? -1 : x > y;
+}
+
+/* Look up a percentile of sorted samples, by the nearest rank
+ * @params:
+ *   samples: sorted samples
+ *   count: number of samples
+ *   pct: percentile, 0 to 100
+ * @returns:
+ *   the sample at the percentile
+ */
+static double percentile(const double *samples, int count, int pct) {
+    int rank = (pct * count + 99) / 100;
+    return samples[rank > 0 ? rank - 1 : 0];
+}
+
+/* Run a case and report the time per operation
+ * @params:
+ *   bc: case
+ *   reps: timed repetitions
+ *   warmup: untimed repetitions
+ *   json: write a JSON object instead of a table row
+ * @returns:
+ *   none
+ */
+static void run_case(const bench_case_t *bc, int reps, int warmup, int json) {
+    double *samples = malloc(reps * sizeof(double));
+    long long ops = 0;
+    assert(samples);
+
+    for (int i = 0; i < warmup; i++) {
+        bc->run(bc, &ops);
+    }
+    for (int i = 0; i < reps; i++) {
+        double elapsed = bc->run(bc, &ops);
+        samples[i] = ops > 0 ? elapsed / ops : 0;
+    }
+    qsort(samples, reps, sizeof(double), compare_double);
+
+    if (json) {
+        printf("{\"name\": \"%s\", \"reps\": %d, \"ops_per_rep\": %lld, \"min_ns\": %.2f, \"p10_ns\": %.2f, "
+               "\"median_ns\": %.2f, \"p90_ns\": %.2f, \"max_ns\": %.2f}\n", bc->name, reps, ops, samples[0],
+               percentile(samples, reps, 10), percentile(samples, reps, 50), percentile(samples, reps, 90),
+               samples[reps - 1]);
+    } else {
+        printf("%-36s %10lld %10.2f %10.2f %10.2f\n", bc->name, ops, percentile(samples, reps, 10),
+               percentile(samples, reps, 50), percentile(samples, reps, 90));
+    }
+    fflush(stdout);
+    free(samples);
+}
+
+/* Add a case to the list
+ * @params:
+ *   cases: list of cases
+ *   count: number of cases in the list, incremented
+ *   run: function running a repetition
+ *   a, b, c: parameters of the case
+ *   name: printf format of the name, followed by its arguments
+ * @returns:
+ *   none
+ */
+static void add_case(bench_case_t *cases, int *count, double (*run)(const bench_case_t *, long long *),
+                     int a, int b, int c, const char *name, ...) {
+    va_list args;
+    bench_case_t *bc = &cases[(*count)++];
+    assert(*count <= CASES_MAX);
+    va_start(args, name);
+    vsnprintf(bc->name, sizeof(bc->name), name, args);
+    va_end(args);
+    bc->run = run;
+    bc->a = a;
+    bc->b = b;
+    bc->c = c;
+}
+
+int main(int argc, char *argv[]) {
+    static const int queue_sizes[] = {10, 1000, 100000};
+    static const int depths[][2] = {{1, 100000}, {4, 20}, {16, 2}};
+    static const int nodes[][2] = {{100, 1}, {1000, 1}, {1000, 4}};
+    static bench_case_t cases[CASES_MAX];
+    int num_cases = 0;
+    int reps = 21;
+    int warmup = 3;
+    int json = 0;
+    int list = 0;
+    char *filter = NULL;
+
+    /* Process the command line options
+     */
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--reps") && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+            if (reps < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--warmup") && i + 1 < argc) {
+            warmup = atoi(argv[++i]);
+            if (warmup < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--list")) {
+            list = 1;
+        } else if (!strcmp(argv[i], "--json")) {
+            json = 1;
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    for (int s = 0; s < 3; s++) {
+        for (int impl = PRIO_Q_HEAP; impl <= PRIO_Q_LIST; impl++) {
+            for (int dist = 0; dist < DIST_COUNT; dist++) {
+                add_case(cases, &num_cases, run_prio_q, impl, dist, queue_sizes[s], "prio_q/%s/%s/%d",
+                         IMPL_NAMES[impl], DIST_NAMES[dist], queue_sizes[s]);
+            }
+        }
+    }
+    for (int d = 0; d < 3; d++) {
+        add_case(cases, &num_cases, run_next_op, depths[d][0], depths[d][1], 0, "context_next_op/depth%d/x%d",
+                 depths[d][0], depths[d][1]);
+    }
+    for (int n = 0; n < 3; n++) {
+        add_case(cases, &num_cases, run_node, nodes[n][0], nodes[n][1], POLICY_PRIORITY, "node_simulate/%dprocs/%dcpu",
+                 nodes[n][0], nodes[n][1]);
+    }
+
+    if (!json && !list) {
+        printf("%-36s %10s %10s %10s %10s\n", "case", "ops/rep", "p10 ns/op", "median", "p90");
+    }
+    for (int i = 0; i < num_cases; i++) {
+        if (filter && !strstr(cases[i].name, filter)) {
+            continue;
+        }
+        if (list) {
+            printf("%s\n", cases[i].name);
+        } else {
+            run_case(&cases[i], reps, warmup, json);
+        }
+    }
+    program_free_all();
+    return 0;
+}
@@ -7,13 +7,89 @@
 #include <assert.h>
 #include "context.h"
 
+/* The scheduler relies on a context fitting in one cache line
+ */
+_Static_assert(sizeof(context) <= CONTEXT_ALIGN, "context does not fit in a cache line");
+
 static const char *OPS[] = {"HALT", "DOOP", "LOOP", "END", "BLOCK", NULL};
 
-/* PUSH, POP, and PEEK macros to manipulate the stack in the process context.
+/* PUSH and POP macros to manipulate the stack in the process context.
  */
 #define PUSH(s, v) (*(s++) = v)
 #define POP(s) (*(--s))
-#define PEEK(s) (*(s - 1))
+
+/* Creates a context for a process running a compiled program
+ * @params:
+ *   arena: arena from which to allocate the context, its cold part and its stack, or NULL to use the heap
+ *   name: program name, at most 10 characters are kept
+ *   prog: compiled program, see program_intern
+ *   priority: process priority
+ *   node: node on which the process is to be simulated
+ * @returns:
+ *   pointer to the new context
+ */
+extern context *context_create(arena_t *arena, const char *name, program *prog, int priority, int node) {
+    /* Allocate new context on a cache line of its own, and its cold part together with its stack.
+     * The program is shared, only the stack is per process and it only needs
+     * one entry per level of loop nesting.
+     */
+    int depth = CONTEXT_DEPTH(prog);
+    context *cur = arena_alloc_aligned(arena, sizeof(context), CONTEXT_ALIGN);
+    cur->cold = arena_alloc(arena, sizeof(context_cold) + depth * sizeof(int));
+    return context_reuse(cur, name, prog, priority, node);
+}
+
+/* Turns the memory of a context that is no longer needed into a context for a new process
+ * @params:
+ *   cur: context whose stack has CONTEXT_DEPTH(prog) entries, overwritten
+ *   name: program name, at most 10 characters are kept
+ *   prog: compiled program, see program_intern
+ *   priority: process priority
+ *   node: node on which the process is to be simulated
+ * @returns:
+ *   cur
+ */
+extern context *context_reuse(context *cur, const char *name, program *prog, int priority, int node) {
+    int depth = CONTEXT_DEPTH(prog);
+    context_cold *cold = cur->cold;
+    memset(cur, 0, sizeof(context));
+    memset(cold, 0, sizeof(context_cold) + depth * sizeof(int));
+    cur->cold = cold;
+
+    strncpy(cur->cold->name, name, sizeof(cur->cold->name) - 1);
+    cur->priority = priority;
+    cur->node = node;
+
+    cur->code = prog->code;
+    cur->cold->prog = prog;
+    cur->cold->stack = CONTEXT_STACK(cur);
+    cur->cold->depth = depth;
+    cur->cold->first_run = -1;
+
+    /* ip = -1 because we assume that the next primitive to execute will be at index 0
+     */
+    cur->ip = -1;
+    return cur;
+}
+
+/* Copies a context, sharing its program but not its cold part or stack
+ * @params:
+ *   arena: arena from which to allocate the copy, or NULL to use the heap
+ *   proc: context to copy, created by context_create
+ * @returns:
+ *   pointer to the copy
+ */
+extern context *context_clone(arena_t *arena, const context *proc) {
+    /* The stack follows the cold part, copy both and point the copy at its own stack
+     */
+    size_t size = sizeof(context_cold) + proc->cold->depth * sizeof(int);
+    context *cur = arena_alloc_aligned(arena, sizeof(context), CONTEXT_ALIGN);
+    *cur = *proc;
+    cur->cold = arena_alloc(arena, size);
+    memcpy(cur->cold, proc->cold, size);
+    cur->cold->stack = CONTEXT_STACK(cur) + (proc->cold->stack - CONTEXT_STACK(proc));
+    return cur;
+}
 
 /* Reads in a program description from a file and creates a context for it.
  * @params:
@@ -22,32 +98,26 @@ static const char *OPS[] = {"HALT", "DOOP", "LOOP", "END", "BLOCK", NULL};
  *   pointer to the new context or NULL if an error has occurred
  */
 extern context *context_load(FILE *fin) {
-    /* Allocate new context and assume that it is successful,
-     */
-    context *cur = calloc(1, sizeof(context));
-    assert(cur);
-
     /* Read in the program description header and do some very basic validation
      * We assume it will be correct for the most part.
      */
-    int size;
-    if (fscanf(fin, "%10s %d %d %d", cur->name, &size, &cur->priority, &cur->node) < 3) {
+    char name[11];
+    int size, priority, node = 0;
+    if (fscanf(fin, "%10s %d %d %d", name, &size, &priority, &node) < 3) {
         fprintf(stderr, "Bad input: Expecting program name, size, and priority\n");
         return NULL;
     }
 
-    /* Allocate the primitive array and stack for the process.
-     * We assume that the allocations will be successful.
+    /* The arrival time is optional, scanf leaves the primitive in the input if it is not there
      */
-    cur->stack = malloc(2 * sizeof(int) * size);
-    assert(cur->stack);
-
-    cur->code = malloc(size * sizeof(opcode));
-    assert(cur->code);
+    int arrival = 0;
+    if (fscanf(fin, "%d", &arrival) == 1 && arrival < 0) {
+        fprintf(stderr, "Bad input: Negative arrival time in %s\n", name);
+        return NULL;
+    }
 
-    /* ip = -1 because we assume that the next primitive to execute will be at index 0
-     */
-    cur->ip = -1;
+    opcode *code = malloc((size > 0 ? size : 1) * sizeof(opcode));
+    assert(code);
 
     /* Read in the primitives with very basic validation
      */
@@ -58,7 +128,7 @@ extern context *context_load(FILE *fin) {
          */
         if (fscanf(fin, "%9s", op) < 1) {
             fprintf(stderr, "Bad input: Expecting operation on line %d in %s\n",
-                    i + 1, cur->name);
+                    i + 1, name);
             return NULL;
         }
 
@@ -67,14 +137,15 @@ extern context *context_load(FILE *fin) {
          * We use an if statement to identify which primitives have an argument
          * Apart from checking that the argument is an integer, no validation is done.
          */
-        cur->code[i].op = -1;
+        code[i].op = -1;
+        code[i].arg = 0;
         for (int j = 0; OPS[j]; j++) {
             if (!strcmp(op, OPS[j])) {
-                cur->code[i].op = j;
+                code[i].op = j;
                 if (j == OP_LOOP || j == OP_DOOP || j == OP_BLOCK) {
-                    if (fscanf(fin, "%d", &cur->code[i].arg) < 1) {
+                    if (fscanf(fin, "%d", &code[i].arg) < 1) {
                         fprintf(stderr, "Bad input: Expecting argument to op on line %d in %s\n",
-                                i + 1, cur->name);
+                                i + 1, name);
                         return NULL;
                     }
                 }
@@ -84,11 +155,21 @@ extern context *context_load(FILE *fin) {
 
         /* This is what happens if the Opcode is unknown.
          */
-        if (cur->code[i].op == -1) {
+        if (code[i].op == -1) {
             fprintf(stderr, "Bad input: operation %d unknown: %s\n", i + 1, op);
             return NULL;
         }
     }
+
+    /* Compile the program, sharing it with other processes running the same program
+     */
+    program *prog = program_intern(code, size, name);
+    free(code);
+    if (!prog) {
+        return NULL;
+    }
+    context *cur = context_create(NULL, name, prog, priority, node);
+    cur->arrival = arrival;
     return cur;
 }
 
@@ -108,45 +189,43 @@ extern int context_next_op(context *cur) {
      * Statistics are updated depending on the primitive.
      */
     for (;;) {
-        cur->ip++;
-        switch (cur->code[cur->ip].op) {
+        bytecode bc = cur->code[++cur->ip];
+        switch (BC_OP(bc)) {
             case OP_LOOP:
                 /* Use a stack to keep track of nested loops by pushing
-                 * the start of loop and number of iterations on the stack.
+                 * the number of iterations on the stack.
                  */
-                PUSH(cur->stack, cur->ip);
-                PUSH(cur->stack, cur->code[cur->ip].arg);
+                PUSH(cur->cold->stack, BC_ARG(bc));
                 break;
             case OP_DOOP:
-                cur->doop_count++;
-                cur->doop_time += cur->code[cur->ip].arg;
+                cur->op = bc;
+                cur->cold->doop_count++;
+                cur->cold->doop_time += BC_ARG(bc);
                 return 1;
             case OP_BLOCK:
-                cur->block_count++;
-                cur->block_time += cur->code[cur->ip].arg;
+                cur->op = bc;
+                cur->cold->block_count++;
+                cur->cold->block_time += BC_ARG(bc);
                 return 1;
             case OP_END:
                 /* The top of stack contains current loop info.
                  * Number of iterations is one-less now.
                  */
-                count = POP(cur->stack);
+                count = POP(cur->cold->stack);
                 count--;
-                if (count == 0) {
-                    /* Stack needs to be cleared if the loop is done.
-                    */
-                    POP(cur->stack);
-                } else {
+                if (count != 0) {
                     /* Stack needs to be updated with new count and
-                     * ip moved to start of loop body.
+                     * ip moved to start of loop body, the END's argument is the index of its LOOP.
                      */
-                    cur->ip = PEEK(cur->stack);
-                    PUSH(cur->stack, count);
+                    cur->ip = BC_ARG(bc);
+                    PUSH(cur->cold->stack, count);
                 }
                 break;
             case OP_HALT:
+                cur->op = bc;
                 return 0;
             default:
-                printf("error, unknown opcode %d at ip %d\n", cur->code[cur->ip].op, cur->ip);
+                printf("error, unknown opcode %d at ip %d\n", BC_OP(bc), cur->ip);
                 return -1;
         }
     }
@@ -160,7 +239,7 @@ extern int context_next_op(context *cur) {
  */
 extern int context_cur_duration(context *cur) {
     assert(cur->ip >= 0);
-    return cur->code[cur->ip].arg;
+    return BC_ARG(cur->op);
 }
 
 /* Returns the current primitive being executed
@@ -171,7 +250,7 @@ extern int context_cur_duration(context *cur) {
  */
 extern int context_cur_op(context *cur) {
     assert(cur->ip >= 0);
-    return cur->code[cur->ip].op;
+    return BC_OP(cur->op);
 }
 
 /* Outputs aggregate statistics about a process to the specified file.
@@ -182,8 +261,16 @@ extern int context_cur_op(context *cur) {
  *   none
  */
 extern void context_stats(context *cur, FILE *fout) {
-    fprintf(fout, "| %5.5d | Proc %02d.%02d | Run %d, Block %d, Wait %d\n", cur->finish_time, cur->node,
-            cur->id, cur->doop_time, cur->block_time, cur->wait_time);
+    context_cold *cold = cur->cold;
+    fprintf(fout, "| %5.5d | Proc %02d.%02d | Run %d, Block %d, Wait %d", cold->finish_time, cur->node,
+            cur->id, cold->doop_time, cold->block_time, cur->wait_time);
+    if (cur->cpu > 0) {
+        fprintf(fout, ", CPU %d", cur->cpu);
+    }
+    if (cold->migrations > 0) {
+        fprintf(fout, ", Migrated %d, Node %d", cold->migrations, cold->host);
+    }
+    fputc('\n', fout);
 
 }
 
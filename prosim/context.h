@@ -6,36 +6,73 @@
 #define ASSIGNMENT_1_CONTEXT_H
 
 #include <stdio.h>
+#include "program.h"
+#include "arena.h"
 
 enum {
     OP_HALT, OP_DOOP, OP_LOOP, OP_END, OP_BLOCK, OP_LAST
 };
 
+/* Source form of a primitive, programs are compiled into packed bytecode (see program.h)
+ */
 typedef struct opcode {
     int op;                     /* primitive op code (see enum above) */
     int arg;                    /* argument value associated with the op code */
 } opcode;
 
-typedef struct context {
-    opcode *code;               /* array of primitives */
-    int *stack;                 /* stack for processing loops */
+/* The part of a process the scheduler rarely touches: its name and place in the workload, where it
+ * ended up, and the statistics that only change when it moves on to its next primitive.
+ * The loop stack follows it in memory.
+ */
+typedef struct context_cold {
+    const program *prog;        /* compiled program the process runs */
+    int *stack;                 /* stack of iterations left in the enclosing loops */
+    int depth;                  /* number of entries the stack has room for */
     char name[11];              /* program name */
-    int ip;                     /* index of current primitive being executed */
-    int id;                     /* process id */
-    int priority;               /* process priority */
-    int node;                   /* node number on which this process is to be simulated */
-    int duration;               /* amount of clock ticks left in current primitive */
-    int state;                  /* current state of process: NEW, READY, RUNNING, BLOCKED, FINISHED */
-    int enqueue_time;           /* time at which process was added to ready queue */
+    int index;                  /* position of the process in the workload */
+    int created;                /* made by process_create, its memory belongs to the simulation and is never released */
+    int host;                   /* node simulating the process, differs from node once it has migrated */
+    int migrations;             /* number of times the process moved to another node */
     int finish_time;            /* time at which process was added to finished queue */
     int doop_count;             /* number of DOOPs performed */
     int doop_time;              /* number of clock ticks spent executing DOOPs*/
     int block_count;            /* number of BLOCKs performed */
     int block_time;             /* number of clock ticks spent being blocked */
+    int first_run;              /* time at which the process first ran, or -1 until it does */
+    int sched;                  /* kept by the scheduling policy: the MLFQ level or the fair share virtual runtime */
+} context_cold;
+
+/* The part of a process the scheduler touches at every state change, which fits in one cache line
+ */
+typedef struct context {
+    const bytecode *code;       /* array of primitives, shared with other processes running the same program */
+    context_cold *cold;         /* the rest of the process */
+    bytecode op;                /* current primitive, so the scheduler need not look it up in code */
+    int ip;                     /* index of current primitive being executed */
+    int duration;               /* amount of clock ticks left in current primitive */
+    int priority;               /* process priority */
+    int state;                  /* current state of process: NEW, READY, RUNNING, BLOCKED, FINISHED */
+    int cpu;                    /* CPU the process is queued on or last ran on, from 1, 0 on single CPU nodes */
+    int enqueue_time;           /* time at which process was added to ready queue */
+    int arrival;                /* time at which the process is admitted to its node */
+    int id;                     /* process id */
+    int node;                   /* node number on which this process is to be simulated */
     int wait_count;             /* number of times process is added to the ready queue */
     int wait_time;              /* number of clock ticks spent waiting in ready queue */
 } context;
 
+/* Alignment of a context, so that it does not straddle two cache lines
+ */
+#define CONTEXT_ALIGN 64
+
+/* Bottom of a process' loop stack
+ */
+#define CONTEXT_STACK(cur) ((int *) ((cur)->cold + 1))
+
+/* Number of stack entries of a process running a program, one per level of loop nesting
+ */
+#define CONTEXT_DEPTH(prog) ((prog)->max_depth > 0 ? (prog)->max_depth : 1)
+
 /* Move the instruction pointer to the next DOOP, BLOCK or HALT to be executed.
  * @params:
  *   cur: pointer to process context
@@ -46,6 +83,39 @@ typedef struct context {
  */
 extern int context_next_op(context *cur);
 
+/* Creates a context for a process running a compiled program
+ * @params:
+ *   arena: arena from which to allocate the context, its cold part and its stack, or NULL to use the heap
+ *   name: program name, at most 10 characters are kept
+ *   prog: compiled program, see program_intern
+ *   priority: process priority
+ *   node: node on which the process is to be simulated
+ * @returns:
+ *   pointer to the new context
+ */
+extern context *context_create(arena_t *arena, const char *name, program *prog, int priority, int node);
+
+/* Turns the memory of a context that is no longer needed into a context for a new process
+ * @params:
+ *   cur: context whose stack has CONTEXT_DEPTH(prog) entries, overwritten
+ *   name: program name, at most 10 characters are kept
+ *   prog: compiled program, see program_intern
+ *   priority: process priority
+ *   node: node on which the process is to be simulated
+ * @returns:
+ *   cur
+ */
+extern context *context_reuse(context *cur, const char *name, program *prog, int priority, int node);
+
+/* Copies a context, sharing its program but not its cold part or stack
+ * @params:
+ *   arena: arena from which to allocate the copy, or NULL to use the heap
+ *   proc: context to copy, created by context_create
+ * @returns:
+ *   pointer to the copy
+ */
+extern context *context_clone(arena_t *arena, const context *proc);
+
 /* Reads in a program description from a file and creates a context for it.
  * @params:
  *   fin: FILE from which to read
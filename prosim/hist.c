@@ -0,0 +1,100 @@
+//
+// Log-bucketed histograms of non-negative times, in the style of HdrHistogram.
+//
+
+#include "hist.h"
+
+/* Find the bucket of a value
+ * @params:
+ *   value: non-negative value
+ * @returns:
+ *   index of the bucket
+ */
+static int bucket_of(int value) {
+    if (value < HIST_SUB) {
+        return value;
+    }
+    /* The top HIST_SUB_BITS + 1 bits of the value pick the bucket within its power of two range
+     */
+    int e = 31 - __builtin_clz((unsigned int) value);
+    int shift = e - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (value >> shift) - HIST_SUB;
+}
+
+/* Find the largest value in a bucket
+ * @params:
+ *   bucket: index of the bucket
+ * @returns:
+ *   the largest value that falls in the bucket
+ */
+static int bucket_top(int bucket) {
+    if (bucket < HIST_SUB) {
+        return bucket;
+    }
+    int shift = bucket / HIST_SUB - 1;
+    long long low = (long long) (bucket % HIST_SUB + HIST_SUB) << shift;
+    return (int) (low + (1ll << shift) - 1);
+}
+
+/* Records a value, negative values are recorded as 0
+ * @params:
+ *   h: histogram
+ *   value: value to record
+ * @returns:
+ *   none
+ */
+extern void hist_record(hist_t *h, int value) {
+    value = value < 0 ? 0 : value;
+    h->counts[bucket_of(value)]++;
+    h->count++;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+/* Adds the values recorded in one histogram to another
+ * @params:
+ *   dst: histogram to add to
+ *   src: histogram to add
+ * @returns:
+ *   none
+ */
+extern void hist_merge(hist_t *dst, const hist_t *src) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/* Returns the value below or at which a given percentage of the recorded values are
+ * @params:
+ *   h: histogram
+ *   percent: percentage, 0 to 100
+ * @returns:
+ *   the largest value in the bucket holding the percentile, at most the largest value recorded,
+ *   or 0 if nothing was recorded
+ */
+extern int hist_percentile(const hist_t *h, double percent) {
+    if (h->count == 0) {
+        return 0;
+    }
+
+    /* Rank of the value, counting from 1
+     */
+    double exact = percent / 100.0 * (double) h->count;
+    unsigned long long rank = (unsigned long long) exact;
+    rank += (double) rank < exact || rank == 0;
+
+    unsigned long long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            int top = bucket_top(i);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
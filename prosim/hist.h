@@ -0,0 +1,49 @@
+//
+// Log-bucketed histograms of non-negative times, in the style of HdrHistogram.
+//
+
+#ifndef PROSIM_HIST_H
+#define PROSIM_HIST_H
+
+/* Each power of two range of values is split into HIST_SUB buckets, so a value is known to within
+ * 1 part in HIST_SUB, and values below HIST_SUB exactly.  The buckets cover every non-negative int.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS) * HIST_SUB)
+
+typedef struct hist {
+    unsigned long long counts[HIST_BUCKETS];
+    unsigned long long count;   /* number of values recorded */
+    int max;                    /* largest value recorded */
+} hist_t;
+
+/* Records a value, negative values are recorded as 0
+ * @params:
+ *   h: histogram
+ *   value: value to record
+ * @returns:
+ *   none
+ */
+extern void hist_record(hist_t *h, int value);
+
+/* Adds the values recorded in one histogram to another
+ * @params:
+ *   dst: histogram to add to
+ *   src: histogram to add
+ * @returns:
+ *   none
+ */
+extern void hist_merge(hist_t *dst, const hist_t *src);
+
+/* Returns the value below or at which a given percentage of the recorded values are
+ * @params:
+ *   h: histogram
+ *   percent: percentage, 0 to 100
+ * @returns:
+ *   the largest value in the bucket holding the percentile, at most the largest value recorded,
+ *   or 0 if nothing was recorded
+ */
+extern int hist_percentile(const hist_t *h, double percent);
+
+#endif //PROSIM_HIST_H
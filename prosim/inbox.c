@@ -0,0 +1,119 @@
+//
+// Lock-free single producer, single consumer inbox used to hand processes to a node thread.
+//
+
+#include <stddef.h>
+#include "inbox.h"
+
+/* Initialize an empty inbox
+ * @params:
+ *   ib: inbox to initialize
+ *   stub: cell used as the initial stub, owned by the inbox from now on
+ * @returns:
+ *   none
+ */
+extern void inbox_init(inbox_t *ib, inbox_cell_t *stub) {
+    atomic_init(&stub->next, NULL);
+    ib->head = stub;
+    ib->tail = stub;
+    atomic_init(&ib->closed, 0);
+    atomic_init(&ib->waiting, 0);
+    pthread_mutex_init(&ib->lock, NULL);
+    pthread_cond_init(&ib->cond, NULL);
+}
+
+/* Wakes up the consumer if it is sleeping on the inbox
+ * The consumer announces that it is about to sleep before checking the inbox one last time,
+ * and the producer publishes before checking for a sleeper, so one of them always sees the other.
+ * @params:
+ *   ib: inbox
+ * @returns:
+ *   none
+ */
+static void wake_consumer(inbox_t *ib) {
+    if (atomic_load(&ib->waiting)) {
+        pthread_mutex_lock(&ib->lock);
+        pthread_cond_signal(&ib->cond);
+        pthread_mutex_unlock(&ib->lock);
+    }
+}
+
+/* Adds an item to the inbox, producer only
+ * @params:
+ *   ib: inbox
+ *   cell: unused cell to carry the item, owned by the inbox from now on
+ *   item: item to add
+ * @returns:
+ *   none
+ */
+extern void inbox_push(inbox_t *ib, inbox_cell_t *cell, void *item) {
+    cell->item = item;
+    atomic_init(&cell->next, NULL);
+    atomic_store(&ib->tail->next, cell);
+    ib->tail = cell;
+    wake_consumer(ib);
+}
+
+/* Marks the end of the items, producer only
+ * @params:
+ *   ib: inbox
+ * @returns:
+ *   none
+ */
+extern void inbox_close(inbox_t *ib) {
+    atomic_store(&ib->closed, 1);
+    wake_consumer(ib);
+}
+
+/* Returns the oldest item without removing it, consumer only.
+ * If wait is set and the inbox is empty, sleeps until an item arrives or the inbox is closed.
+ * @params:
+ *   ib: inbox
+ *   wait: whether to wait for an item
+ * @returns:
+ *   oldest item, or NULL if the inbox is empty (and closed, when waiting)
+ */
+extern void *inbox_peek(inbox_t *ib, int wait) {
+    inbox_cell_t *next = atomic_load_explicit(&ib->head->next, memory_order_acquire);
+    if (next || !wait || atomic_load(&ib->closed)) {
+        /* The closed flag is set after the last push, so look again once it is seen
+         */
+        if (!next) {
+            next = atomic_load_explicit(&ib->head->next, memory_order_acquire);
+        }
+        return next ? next->item : NULL;
+    }
+
+    pthread_mutex_lock(&ib->lock);
+    atomic_store(&ib->waiting, 1);
+    while (!(next = atomic_load(&ib->head->next)) && !atomic_load(&ib->closed)) {
+        pthread_cond_wait(&ib->cond, &ib->lock);
+    }
+    atomic_store(&ib->waiting, 0);
+    pthread_mutex_unlock(&ib->lock);
+
+    if (!next) {
+        next = atomic_load(&ib->head->next);
+    }
+    return next ? next->item : NULL;
+}
+
+/* Removes the oldest item, consumer only, the inbox must not be empty
+ * @params:
+ *   ib: inbox
+ * @returns:
+ *   none
+ */
+extern void inbox_pop(inbox_t *ib) {
+    ib->head = atomic_load_explicit(&ib->head->next, memory_order_acquire);
+}
+
+/* Returns true if nothing more will come out of the inbox, consumer only
+ * @params:
+ *   ib: inbox
+ * @returns:
+ *   1 if the inbox is closed and empty, 0 otherwise
+ */
+extern int inbox_done(inbox_t *ib) {
+    return atomic_load(&ib->closed) && atomic_load_explicit(&ib->head->next, memory_order_acquire) == NULL;
+}
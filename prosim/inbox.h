@@ -0,0 +1,85 @@
+//
+// Lock-free single producer, single consumer inbox used to hand processes to a node thread.
+//
+
+#ifndef PROSIM_INBOX_H
+#define PROSIM_INBOX_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "arena.h"
+
+/* Items are linked through cells allocated by the producer.  A consumed cell becomes the
+ * stub at the head of the list, so the producer and consumer never touch the same pointer.
+ */
+typedef struct inbox_cell {
+    struct inbox_cell *_Atomic next;    /* next cell in the inbox */
+    void *item;                         /* item carried by the cell */
+} inbox_cell_t;
+
+/* The consumer's side and the producer's side are on cache lines of their own, so that pushing an item does
+ * not take away the line the consumer looks at on every peek
+ */
+typedef struct inbox {
+    inbox_cell_t *head;         /* consumer side: stub cell, its next cell holds the oldest item */
+    atomic_int closed;          /* set by the producer once nothing more will be pushed */
+    _Alignas(CACHE_LINE) inbox_cell_t *tail;    /* producer side: most recently pushed cell */
+    atomic_int waiting;         /* set by the consumer while it sleeps on an empty inbox */
+    pthread_mutex_t lock;       /* only used to sleep and wake up the consumer */
+    pthread_cond_t cond;
+} inbox_t;
+
+/* Initialize an empty inbox
+ * @params:
+ *   ib: inbox to initialize
+ *   stub: cell used as the initial stub, owned by the inbox from now on
+ * @returns:
+ *   none
+ */
+extern void inbox_init(inbox_t *ib, inbox_cell_t *stub);
+
+/* Adds an item to the inbox, producer only
+ * @params:
+ *   ib: inbox
+ *   cell: unused cell to carry the item, owned by the inbox from now on
+ *   item: item to add
+ * @returns:
+ *   none
+ */
+extern void inbox_push(inbox_t *ib, inbox_cell_t *cell, void *item);
+
+/* Marks the end of the items, producer only
+ * @params:
+ *   ib: inbox
+ * @returns:
+ *   none
+ */
+extern void inbox_close(inbox_t *ib);
+
+/* Returns the oldest item without removing it, consumer only.
+ * If wait is set and the inbox is empty, sleeps until an item arrives or the inbox is closed.
+ * @params:
+ *   ib: inbox
+ *   wait: whether to wait for an item
+ * @returns:
+ *   oldest item, or NULL if the inbox is empty (and closed, when waiting)
+ */
+extern void *inbox_peek(inbox_t *ib, int wait);
+
+/* Removes the oldest item, consumer only, the inbox must not be empty
+ * @params:
+ *   ib: inbox
+ * @returns:
+ *   none
+ */
+extern void inbox_pop(inbox_t *ib);
+
+/* Returns true if nothing more will come out of the inbox, consumer only
+ * @params:
+ *   ib: inbox
+ * @returns:
+ *   1 if the inbox is closed and empty, 0 otherwise
+ */
+extern int inbox_done(inbox_t *ib);
+
+#endif //PROSIM_INBOX_H
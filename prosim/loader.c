@@ -0,0 +1,515 @@
+//
+// Fast loader for workload descriptions.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "loader.h"
+#include "pool.h"
+
+/* Size of the blocks read from the input when it cannot be mapped
+ */
+#define BLOCK_SIZE (1024 * 1024)
+
+/* Every token is guaranteed to be completely in the buffer if it is at most this long.
+ * Longer tokens are not valid input anyway.
+ */
+#define TOKEN_MAX 64
+
+/* Deepest loop nesting of the released contexts kept for reuse, deeper ones are rare and left alone
+ */
+#define SPARE_DEPTH_MAX 8
+
+/* Released contexts with the same stack depth, waiting to be reused
+ */
+typedef struct spare {
+    context **procs;
+    int count;
+    int cap;
+} spare_t;
+
+struct loader {
+    int fd;                 /* input file descriptor, -1 once everything has been read */
+    char *buf;              /* block buffer, or NULL if the input is mapped */
+    size_t cap;             /* size of the block buffer */
+    char *map;              /* mapped input file or NULL */
+    size_t map_len;         /* length of the mapping */
+    const char *p;          /* next unread byte */
+    const char *end;        /* end of the bytes available */
+    opcode *ops;            /* scratch array for the primitives of the program being read */
+    int ops_cap;            /* number of primitives ops has room for */
+    arena_t *arena;         /* arena from which the contexts are allocated */
+    atomic_int spares;      /* number of released contexts waiting to be reused */
+    pthread_mutex_t spare_lock;
+    spare_t spare[SPARE_DEPTH_MAX + 1];     /* released contexts, by stack depth */
+};
+
+/* Reads in more input, keeping the unread bytes.  Reads until at least want bytes are
+ * available or the end of the input is reached.
+ * @params:
+ *   ld: loader
+ *   want: number of bytes wanted
+ * @returns:
+ *   none
+ */
+static void refill(loader_t *ld, size_t want) {
+    size_t left = ld->end - ld->p;
+    if (ld->fd < 0 || left >= want) {
+        return;
+    }
+
+    /* Move the unread bytes to the front of the buffer, growing the buffer if needed
+     */
+    if (want > ld->cap) {
+        char *bigger = malloc(want);
+        assert(bigger);
+        memcpy(bigger, ld->p, left);
+        free(ld->buf);
+        ld->buf = bigger;
+        ld->cap = want;
+    } else {
+        memmove(ld->buf, ld->p, left);
+    }
+    ld->p = ld->buf;
+    ld->end = ld->buf + left;
+
+    while (left < want) {
+        ssize_t n = read(ld->fd, ld->buf + left, ld->cap - left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ld->fd = -1;
+            break;
+        }
+        left += n;
+        ld->end = ld->buf + left;
+    }
+}
+
+/* Skips white space and makes sure the next token, if any, is completely in the buffer
+ * @params:
+ *   ld: loader
+ * @returns:
+ *   1 if there is a token, 0 at the end of the input
+ */
+static int next_token(loader_t *ld) {
+    for (;;) {
+        while (ld->p < ld->end && (*ld->p == ' ' || (*ld->p >= '\t' && *ld->p <= '\r'))) {
+            ld->p++;
+        }
+        if (ld->p < ld->end || ld->fd < 0) {
+            break;
+        }
+        refill(ld, BLOCK_SIZE);
+    }
+    refill(ld, TOKEN_MAX);
+    return ld->p < ld->end;
+}
+
+/* Reads a word of at most max characters, like scanf("%<max>s")
+ * @params:
+ *   ld: loader
+ *   out: where to store the word, at least max + 1 characters
+ *   max: maximum number of characters to read
+ * @returns:
+ *   length of the word, 0 at the end of the input
+ */
+static int read_word(loader_t *ld, char *out, int max) {
+    int len = 0;
+    if (!next_token(ld)) {
+        return 0;
+    }
+    while (len < max && ld->p < ld->end && !(*ld->p == ' ' || (*ld->p >= '\t' && *ld->p <= '\r'))) {
+        out[len++] = *ld->p++;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/* Reads an optionally signed decimal integer, like scanf("%d")
+ * @params:
+ *   ld: loader
+ *   value: where to store the integer
+ * @returns:
+ *   1 on success, 0 if the next token is not an integer
+ */
+static int read_int(loader_t *ld, int *value) {
+    if (!next_token(ld)) {
+        return 0;
+    }
+
+    const char *s = ld->p;
+    int neg = 0;
+    if (s < ld->end && (*s == '-' || *s == '+')) {
+        neg = *s++ == '-';
+    }
+    if (s == ld->end || *s < '0' || *s > '9') {
+        return 0;
+    }
+
+    unsigned int v = 0;
+    while (s < ld->end && *s >= '0' && *s <= '9') {
+        v = v * 10 + (*s++ - '0');
+    }
+    *value = neg ? (int) (0u - v) : (int) v;
+    ld->p = s;
+    return 1;
+}
+
+/* Maps an operation name to its op code without a string compare loop
+ * @params:
+ *   s: operation name
+ *   len: length of the name
+ * @returns:
+ *   op code or -1 if the name is unknown
+ */
+static int lookup_op(const char *s, int len) {
+    switch (len) {
+        case 3:
+            if (!memcmp(s, "END", 3)) return OP_END;
+            break;
+        case 4:
+            switch (s[0]) {
+                case 'H':
+                    if (!memcmp(s, "HALT", 4)) return OP_HALT;
+                    break;
+                case 'D':
+                    if (!memcmp(s, "DOOP", 4)) return OP_DOOP;
+                    break;
+                case 'L':
+                    if (!memcmp(s, "LOOP", 4)) return OP_LOOP;
+                    break;
+            }
+            break;
+        case 5:
+            if (!memcmp(s, "BLOCK", 5)) return OP_BLOCK;
+            break;
+    }
+    return -1;
+}
+
+/* Returns true if the op code takes an argument
+ */
+#define HAS_ARG(op) ((op) == OP_LOOP || (op) == OP_DOOP || (op) == OP_BLOCK)
+
+/* Opens a workload for loading.  Regular files are mapped into memory, anything else
+ * (pipes, terminals) is read in large blocks.  Nothing should have been read from fin yet.
+ * @params:
+ *   fin: FILE from which to read
+ *   arena: arena from which the contexts are allocated
+ * @returns:
+ *   pointer to the new loader
+ */
+extern loader_t *loader_open(FILE *fin, arena_t *arena) {
+    loader_t *ld = calloc(1, sizeof(loader_t));
+    assert(ld);
+    ld->fd = fileno(fin);
+    ld->arena = arena;
+    pthread_mutex_init(&ld->spare_lock, NULL);
+
+    /* Map regular files, starting from the current file offset
+     */
+    struct stat st;
+    off_t offset = lseek(ld->fd, 0, SEEK_CUR);
+    if (fstat(ld->fd, &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && st.st_size > offset) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, ld->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            ld->map = map;
+            ld->map_len = st.st_size;
+            ld->p = ld->map + offset;
+            ld->end = ld->map + st.st_size;
+            ld->fd = -1;
+            return ld;
+        }
+    }
+
+    ld->cap = BLOCK_SIZE;
+    ld->buf = malloc(ld->cap);
+    assert(ld->buf);
+    ld->p = ld->end = ld->buf;
+    return ld;
+}
+
+/* Reads the workload header
+ * @params:
+ *   ld: loader
+ *   num_procs, quantum, num_nodes: where to store the header values
+ * @returns:
+ *   1 on success, 0 if the header is malformed
+ */
+extern int loader_header(loader_t *ld, int *num_procs, int *quantum, int *num_nodes) {
+    return read_int(ld, num_procs) && read_int(ld, quantum) && read_int(ld, num_nodes);
+}
+
+/* Reads a word that follows the header values on the header line, if there is one
+ * @params:
+ *   ld: loader, right after loader_header
+ *   out: where to store the word, at least max + 1 characters
+ *   max: maximum number of characters to read
+ * @returns:
+ *   length of the word, 0 if the header line ends after the header values
+ */
+extern int loader_header_word(loader_t *ld, char *out, int max) {
+    for (;;) {
+        refill(ld, TOKEN_MAX);
+        if (ld->p == ld->end || (*ld->p != ' ' && *ld->p != '\t')) {
+            break;
+        }
+        ld->p++;
+    }
+    if (ld->p == ld->end || *ld->p == '\n' || *ld->p == '\r') {
+        return 0;
+    }
+    return read_word(ld, out, max);
+}
+
+/* Takes a released context with a given stack depth, if there is one
+ * @params:
+ *   ld: loader
+ *   depth: stack depth
+ * @returns:
+ *   the context, or NULL if none is waiting to be reused
+ */
+static context *take_spare(loader_t *ld, int depth) {
+    context *cur = NULL;
+    if (atomic_load_explicit(&ld->spares, memory_order_relaxed) == 0 || depth > SPARE_DEPTH_MAX) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ld->spare_lock);
+    spare_t *spare = &ld->spare[depth];
+    if (spare->count > 0) {
+        cur = spare->procs[--spare->count];
+        atomic_fetch_sub(&ld->spares, 1);
+    }
+    pthread_mutex_unlock(&ld->spare_lock);
+    return cur;
+}
+
+/* Hands back the context of a process that is done with, so that loader_next can reuse its memory.
+ * May be called from any thread.
+ * @params:
+ *   ld: loader that created the context
+ *   proc: process' context, no longer used
+ * @returns:
+ *   none
+ */
+extern void loader_release(loader_t *ld, context *proc) {
+    int depth = proc->cold->depth;
+    if (depth > SPARE_DEPTH_MAX) {
+        return;
+    }
+
+    pthread_mutex_lock(&ld->spare_lock);
+    spare_t *spare = &ld->spare[depth];
+    if (spare->count == spare->cap) {
+        spare->cap = spare->cap ? 2 * spare->cap : 64;
+        spare->procs = realloc(spare->procs, spare->cap * sizeof(context *));
+        assert(spare->procs);
+    }
+    spare->procs[spare->count++] = proc;
+    atomic_fetch_add(&ld->spares, 1);
+    pthread_mutex_unlock(&ld->spare_lock);
+}
+
+/* Reads in the next program description and creates a context for it.
+ * Accepts exactly the format read by context_load.
+ * @params:
+ *   ld: loader
+ * @returns:
+ *   pointer to the new context or NULL if an error has occurred
+ */
+extern context *loader_next(loader_t *ld) {
+    char name[11];
+    int size, priority, node, arrival = 0;
+
+    if (!read_word(ld, name, 10) || !read_int(ld, &size) || !read_int(ld, &priority) ||
+        !read_int(ld, &node)) {
+        fprintf(stderr, "Bad input: Expecting program name, size, and priority\n");
+        return NULL;
+    }
+
+    /* The arrival time is optional, primitives never start with a digit
+     */
+    if (read_int(ld, &arrival) && arrival < 0) {
+        fprintf(stderr, "Bad input: Negative arrival time in %s\n", name);
+        return NULL;
+    }
+
+    if (size > ld->ops_cap) {
+        ld->ops_cap = size > 2 * ld->ops_cap ? size : 2 * ld->ops_cap;
+        free(ld->ops);
+        ld->ops = malloc(ld->ops_cap * sizeof(opcode));
+        assert(ld->ops);
+    }
+
+    /* Read in the primitives with the same validation as context_load
+     */
+    for (int i = 0; i < size; i++) {
+        char op[10];
+        int len = read_word(ld, op, 9);
+        if (!len) {
+            fprintf(stderr, "Bad input: Expecting operation on line %d in %s\n", i + 1, name);
+            return NULL;
+        }
+
+        ld->ops[i].op = lookup_op(op, len);
+        ld->ops[i].arg = 0;
+        if (ld->ops[i].op == -1) {
+            fprintf(stderr, "Bad input: operation %d unknown: %s\n", i + 1, op);
+            return NULL;
+        }
+        if (HAS_ARG(ld->ops[i].op) && !read_int(ld, &ld->ops[i].arg)) {
+            fprintf(stderr, "Bad input: Expecting argument to op on line %d in %s\n", i + 1, name);
+            return NULL;
+        }
+    }
+
+    /* Compile the program, sharing it with other processes running the same program
+     */
+    program *prog = program_intern(ld->ops, size, name);
+    if (!prog) {
+        return NULL;
+    }
+    context *cur = take_spare(ld, CONTEXT_DEPTH(prog));
+    cur = cur ? context_reuse(cur, name, prog, priority, node) : context_create(ld->arena, name, prog, priority, node);
+    cur->arrival = arrival;
+    return cur;
+}
+
+/* Skips over the next program description without building a context for it
+ * @params:
+ *   ld: loader
+ * @returns:
+ *   1 on success, 0 if the description is malformed
+ */
+static int skip_record(loader_t *ld) {
+    char word[11];
+    int size, value;
+
+    if (!read_word(ld, word, 10) || !read_int(ld, &size) || !read_int(ld, &value) || !read_int(ld, &value)) {
+        return 0;
+    }
+    read_int(ld, &value);
+    for (int i = 0; i < size; i++) {
+        int len = read_word(ld, word, 9);
+        int op = lookup_op(word, len);
+        if (op < 0 || (HAS_ARG(op) && !read_int(ld, &value))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Work shared by the parser threads of loader_load_all
+ */
+typedef struct {
+    loader_t *ld;           /* loader holding the whole input */
+    const char **starts;    /* start of each program description */
+    int count;              /* number of program descriptions */
+    int chunks;             /* number of ranges the descriptions are split into */
+    context **procs;        /* where to store the contexts */
+    int *ok;                /* result of each range */
+    arena_t *arenas;        /* arena of each range, adopted by the loader's arena when done */
+} parse_job_t;
+
+/* Pool task parsing one range of program descriptions
+ * @params:
+ *   index: index of the range
+ *   arg: pointer to the parse_job_t
+ * @returns:
+ *   none
+ */
+static void parse_range(int index, void *arg) {
+    parse_job_t *job = arg;
+    int lo = (int) ((long long) job->count * index / job->chunks);
+    int hi = (int) ((long long) job->count * (index + 1) / job->chunks);
+
+    /* Each range gets its own view of the input, which is entirely in memory, and its own arena
+     */
+    loader_t view = {.fd = -1, .p = job->starts[lo], .end = job->ld->end, .arena = &job->arenas[index]};
+    job->ok[index] = 1;
+    for (int i = lo; i < hi; i++) {
+        job->procs[i] = loader_next(&view);
+        if (!job->procs[i]) {
+            job->ok[index] = 0;
+            break;
+        }
+    }
+    free(view.ops);
+}
+
+/* Reads in the remaining count program descriptions, parsing them in parallel.
+ * @params:
+ *   ld: loader
+ *   procs: array in which to store the contexts, in input order
+ *   count: number of program descriptions to read
+ *   threads: number of parser threads
+ * @returns:
+ *   1 on success, 0 if an error has occurred
+ */
+extern int loader_load_all(loader_t *ld, context **procs, int count, int threads) {
+    /* The descriptions must all be in memory, so read in the rest of a piped input
+     */
+    while (ld->fd >= 0) {
+        refill(ld, 2 * ld->cap);
+    }
+
+    /* Find where each description starts.  A malformed description is left for
+     * the parser to report.
+     */
+    const char **starts = malloc((count + 1) * sizeof(char *));
+    assert(starts);
+    int found = 0;
+    while (found < count) {
+        starts[found++] = ld->p;
+        if (!skip_record(ld)) {
+            break;
+        }
+    }
+    starts[found] = ld->p;
+
+    int chunks = threads * 4 < found ? threads * 4 : found;
+    parse_job_t job = {ld, starts, found, chunks, procs, calloc(chunks + 1, sizeof(int)),
+                       calloc(chunks + 1, sizeof(arena_t))};
+    assert(job.ok && job.arenas);
+    pool_run(threads, chunks, parse_range, &job, 0);
+
+    int ok = found == count;
+    for (int i = 0; i < chunks; i++) {
+        ok &= job.ok[i];
+        arena_adopt(ld->arena, &job.arenas[i]);
+    }
+    free(job.ok);
+    free(job.arenas);
+    free(starts);
+    return ok;
+}
+
+/* Releases the loader and unmaps or frees its input buffer
+ * @params:
+ *   ld: loader
+ * @returns:
+ *   none
+ */
+extern void loader_close(loader_t *ld) {
+    if (ld->map) {
+        munmap(ld->map, ld->map_len);
+    }
+    free(ld->buf);
+    free(ld->ops);
+    for (int i = 0; i <= SPARE_DEPTH_MAX; i++) {
+        free(ld->spare[i].procs);
+    }
+    pthread_mutex_destroy(&ld->spare_lock);
+    free(ld);
+}
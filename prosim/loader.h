@@ -0,0 +1,83 @@
+//
+// Fast loader for workload descriptions.
+//
+
+#ifndef PROSIM_LOADER_H
+#define PROSIM_LOADER_H
+
+#include <stdio.h>
+#include "context.h"
+#include "arena.h"
+
+typedef struct loader loader_t;
+
+/* Opens a workload for loading.  Regular files are mapped into memory, anything else
+ * (pipes, terminals) is read in large blocks.  Nothing should have been read from fin yet.
+ * @params:
+ *   fin: FILE from which to read
+ *   arena: arena from which the contexts are allocated
+ * @returns:
+ *   pointer to the new loader
+ */
+extern loader_t *loader_open(FILE *fin, arena_t *arena);
+
+/* Reads the workload header
+ * @params:
+ *   ld: loader
+ *   num_procs, quantum, num_nodes: where to store the header values
+ * @returns:
+ *   1 on success, 0 if the header is malformed
+ */
+extern int loader_header(loader_t *ld, int *num_procs, int *quantum, int *num_nodes);
+
+/* Reads a word that follows the header values on the header line, if there is one
+ * @params:
+ *   ld: loader, right after loader_header
+ *   out: where to store the word, at least max + 1 characters
+ *   max: maximum number of characters to read
+ * @returns:
+ *   length of the word, 0 if the header line ends after the header values
+ */
+extern int loader_header_word(loader_t *ld, char *out, int max);
+
+/* Reads in the next program description and creates a context for it.
+ * Accepts exactly the format read by context_load.
+ * @params:
+ *   ld: loader
+ * @returns:
+ *   pointer to the new context or NULL if an error has occurred
+ */
+extern context *loader_next(loader_t *ld);
+
+/* Hands back the context of a process that is done with, so that loader_next can reuse its memory.
+ * May be called from any thread.
+ * @params:
+ *   ld: loader that created the context
+ *   proc: process' context, no longer used
+ * @returns:
+ *   none
+ */
+extern void loader_release(loader_t *ld, context *proc);
+
+/* Reads in the remaining count program descriptions, parsing them in parallel.
+ * A quick first pass finds where each description starts, then the descriptions
+ * are split into ranges that are parsed on a worker pool.
+ * @params:
+ *   ld: loader
+ *   procs: array in which to store the contexts, in input order
+ *   count: number of program descriptions to read
+ *   threads: number of parser threads
+ * @returns:
+ *   1 on success, 0 if an error has occurred
+ */
+extern int loader_load_all(loader_t *ld, context **procs, int count, int threads);
+
+/* Releases the loader and unmaps or frees its input buffer
+ * @params:
+ *   ld: loader
+ * @returns:
+ *   none
+ */
+extern void loader_close(loader_t *ld);
+
+#endif //PROSIM_LOADER_H
@@ -7,58 +7,667 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include "context.h"
-#include "process.h"
+#include <string.h>
+#include <assert.h>
+#include "prosim.h"
 
-int main() {
+/* Number of processes routed between looks at which statistics can be written out
+ */
+#define STREAM_EVERY 1024
+
+/* Print the command line options
+ * @params:
+ *   prog: name of the executable
+ * @returns:
+ *   none
+ */
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [options] < workload\n"
+                    "  --quantum Q|LO..HI  CPU quantum, overriding the workload's, or a range of quantums to sweep:\n"
+                    "                   each is simulated on its own, side by side on a pool of workers sized to the\n"
+                    "                   hardware concurrency or --workers, and summarized in a table\n"
+                    "  --sweep-trace    with a range of quantums, also output the trace and statistics of each\n"
+                    "  --tick           advance the clock one tick at a time instead of event to event\n"
+                    "  --cpus N[,N...]  CPUs per node, a single count applies to every node, otherwise\n"
+                    "                   the counts are for nodes 1, 2, ... and the last one is repeated\n"
+                    "  --balance N      every N ticks, migrate ready processes from overloaded nodes to idle ones,\n"
+                    "                   the nodes advance in lock step and each needs its own thread\n"
+                    "  --migrate-cost N ticks a migrating process spends in transit (default 0)\n"
+                    "  --checkpoint FILE  every --checkpoint-every ticks, stop all the nodes at the same tick and write\n"
+                    "                   a snapshot of the simulation to FILE, each node needs its own thread\n"
+                    "  --checkpoint-every N  ticks between snapshots (default 10000)\n"
+                    "  --resume FILE    continue the simulation of the workload from the snapshot in FILE, writing the\n"
+                    "                   output that follows the snapshot, the settings must be those it was taken with\n"
+                    "  --queue list|heap  priority queue implementation (default heap)\n"
+                    "  --blocked queue|wheel  hold blocked processes in a priority queue (default) or a timing wheel\n"
+                    "  --policy NAME    scheduling policy, overriding the one the workload header may name after\n"
+                    "                   its values, priority by default\n"
+                    "  --trace-order interleaved|node\n"
+                    "                   write each node's trace in chunks as it is produced (default),\n"
+                    "                   or hold the traces back and write them out in node order\n"
+                    "  --binary-trace FILE  write the trace to FILE as binary records, see prosim-decode\n"
+                    "  --trace-delta    delta encode the binary trace records\n"
+                    "  --pool           simulate the nodes on a work stealing pool sized to the hardware\n"
+                    "                   concurrency instead of one thread per node\n"
+                    "  --workers N      like --pool, with N worker threads\n"
+                    "  --batch N        simulate the nodes in groups of N, each group on one thread or pool task, advancing\n"
+                    "                   its nodes in lock step, for workloads with many nodes of few processes\n"
+                    "  --pin            pin each node's thread, or each pool worker, to a CPU, filling one NUMA node's CPUs\n"
+                    "                   before the next, so a node's trace buffer and the memory it allocates while it is\n"
+                    "                   simulated stay local to its thread\n"
+                    "  --parse-threads N  load the whole workload first, parsing it on N threads\n"
+                    "  --arena-stats    report the peak memory use of each arena on stderr\n"
+                    "  --metrics        print each node's hot path counters as JSON after the statistics\n"
+                    "  --quiet          instead of the trace and each process' statistics, print the percentiles of the\n"
+                    "                   wait, block, turnaround and response times and the CPU utilization of each node\n"
+                    "                   and of the whole cluster\n", prog);
+    fprintf(stderr, "Scheduling policies:\n");
+#define POLICY_USAGE(id, name, description) fprintf(stderr, "  %-16s %s\n", name, description);
+    PROCESS_POLICIES(POLICY_USAGE)
+#undef POLICY_USAGE
+}
+
+/* How each simulation of a run is set up, from the command line
+ */
+typedef struct config {
+    int engine;             /* ENGINE_EVENT or ENGINE_TICK */
+    int blocked;            /* BLOCKED_QUEUE or BLOCKED_WHEEL */
+    int policy;             /* scheduling policy, or -1 until it is known */
+    char *cpus;             /* CPU counts of the nodes, see set_cpus, or NULL for one CPU each */
+    int balance;            /* ticks between balancing rounds, 0 to not balance */
+    int migrate_cost;       /* ticks a migrating process spends in transit */
+    char *checkpoint;       /* file to write snapshots to, or NULL */
+    int checkpoint_every;   /* ticks between snapshots */
+} config_t;
+
+/* Give each node its number of CPUs
+ * @params:
+ *   sim: simulation
+ *   spec: comma separated CPU counts, for nodes 1, 2, ..., the last count applies to the remaining nodes
+ *   num_nodes: number of nodes
+ * @returns:
+ *   1 on success, 0 if spec is not a list of counts between 1 and PROCESS_CPUS_MAX
+ */
+static int set_cpus(sim_t *sim, char *spec, int num_nodes) {
+    int count = 1;
+    for (int node = 1; node <= num_nodes || *spec; node++) {
+        if (*spec) {
+            char *end;
+            count = (int) strtol(spec, &end, 10);
+            if (end == spec || (*end && *end != ',') || count < 1 || count > PROCESS_CPUS_MAX) {
+                return 0;
+            }
+            spec = *end ? end + 1 : end;
+        }
+        if (node <= num_nodes) {
+            process_set_cpus(sim, node, count);
+        }
+    }
+    return 1;
+}
+
+/* Create a simulation set up as given on the command line
+ * @params:
+ *   cfg: settings from the command line
+ *   quantum: CPU quantum
+ *   num_nodes: number of nodes
+ * @returns:
+ *   the new simulation, or NULL if the CPU counts are bad
+ */
+static sim_t *sim_create(config_t *cfg, int quantum, int num_nodes) {
+    sim_t *sim = process_init(quantum, num_nodes);
+    process_set_engine(sim, cfg->engine);
+    process_set_blocked(sim, cfg->blocked);
+    process_set_policy(sim, cfg->policy);
+    if (cfg->balance > 0) {
+        process_set_balance(sim, cfg->balance, cfg->migrate_cost);
+    }
+    if (cfg->checkpoint) {
+        process_set_checkpoint(sim, cfg->checkpoint, cfg->checkpoint_every);
+    }
+    if (cfg->cpus && !set_cpus(sim, cfg->cpus, num_nodes)) {
+        process_free(sim);
+        return NULL;
+    }
+    return sim;
+}
+
+/* Hand the context of a process whose statistics have been written back to the loader, for reuse
+ * @params:
+ *   arg: loader that created the context
+ *   proc: process' context
+ * @returns:
+ *   none
+ */
+static void release_context(void *arg, context *proc) {
+    loader_release(arg, proc);
+}
+
+/* Parse a quantum or a range of quantums
+ * @params:
+ *   spec: Q or LO..HI
+ *   lo: where to store the first quantum
+ *   hi: where to store the last quantum
+ * @returns:
+ *   1 for a single quantum, 2 for a range, 0 if spec is neither
+ */
+static int parse_quantum(char *spec, int *lo, int *hi) {
+    char *end;
+    *lo = *hi = (int) strtol(spec, &end, 10);
+    if (end == spec || *lo < 1) {
+        return 0;
+    } else if (!*end) {
+        return 1;
+    } else if (strncmp(end, "..", 2)) {
+        return 0;
+    }
+    spec = end + 2;
+    *hi = (int) strtol(spec, &end, 10);
+    return end != spec && !*end && *hi >= *lo ? 2 : 0;
+}
+
+/* Nodes of a simulation and the threads to simulate them on
+ */
+typedef struct run {
+    sim_t *sim;
+    int num_nodes;
+    int workers;            /* size of the pool simulating the nodes, 0 for one thread per group of nodes */
+    int batch;              /* nodes per group, simulated in lock step if more than one */
+    int pin;                /* whether the threads simulating the nodes are pinned to CPUs */
+} run_t;
+
+/* Simulate one group of nodes
+ * @params:
+ *   run: the run
+ *   index: index of the group
+ * @returns:
+ *   none
+ */
+static void simulate_group(run_t *run, int index) {
+    int first_id = index * run->batch + 1;
+    int count = run->num_nodes - first_id + 1 < run->batch ? run->num_nodes - first_id + 1 : run->batch;
+    if (count == 1) {
+        node_simulate(run->sim, first_id);
+    } else {
+        node_simulate_batch(run->sim, first_id, count);
+    }
+}
+
+/* Pool task simulating one group of nodes
+ * @params:
+ *   index: index of the group
+ *   arg: the run
+ * @returns:
+ *   none
+ */
+static void simulate_task(int index, void *arg) {
+    simulate_group(arg, index);
+}
+
+/* A group of nodes for a thread of its own to simulate
+ */
+typedef struct node_run {
+    run_t *run;
+    int index;
+} node_run_t;
+
+/* Thread simulating one group of nodes
+ * @params:
+ *   arg: pointer to the node_run_t
+ * @returns:
+ *   NULL
+ */
+static void *simulate_node(void *arg) {
+    node_run_t *node = arg;
+    if (node->run->pin) {
+        affinity_pin(node->index);
+    }
+    simulate_group(node->run, node->index);
+    return NULL;
+}
+
+/* Simulate all the nodes, either on a pool of workers or with one thread per node or group of nodes
+ * @params:
+ *   arg: pointer to the run
+ * @returns:
+ *   NULL
+ */
+static void *simulate_nodes(void *arg) {
+    run_t *run = arg;
+    int num_groups = (run->num_nodes + run->batch - 1) / run->batch;
+
+    if (run->workers > 0) {
+        // Simulating the groups of nodes as tasks on a fixed pool of workers
+        pool_run(run->workers, num_groups, simulate_task, run, run->pin);
+    } else {
+        // Creating threads for each group of nodes
+        pthread_t *threads = malloc(num_groups * sizeof(pthread_t));
+        node_run_t *node_runs = malloc(num_groups * sizeof(node_run_t));
+
+        // launching simulation for each group by calling node_simulate or node_simulate_batch
+        for (int i = 0; i < num_groups; i++) {
+            node_runs[i].run = run;
+            node_runs[i].index = i;
+            pthread_create(&threads[i], NULL, simulate_node, &node_runs[i]);
+        }
+
+        // waiting for all threads to complete execution
+        for (int i = 0; i < num_groups; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+        free(node_runs);
+    }
+    return NULL;
+}
+
+/* A sweep over a range of quantums.  The processes are loaded once and each configuration
+ * simulates its own copies of them, which share the loaded programs.
+ */
+typedef struct sweep {
+    config_t *cfg;
+    context **procs;        /* the processes as loaded, never simulated themselves */
+    int num_procs;
+    int num_nodes;
+    int quantum;            /* quantum of the first configuration, the others follow it */
+    int keep;               /* keep the simulations around for their traces and statistics */
+    int pin;                /* whether the workers, and the threads of balanced configurations, are pinned to CPUs */
+    sim_t **sims;           /* simulation of each configuration, if kept */
+    arena_t *arenas;        /* copies of the processes of each configuration */
+    char **rows;            /* summary row of each configuration */
+} sweep_t;
+
+/* Pool task simulating one configuration of a sweep
+ * @params:
+ *   index: index of the configuration
+ *   arg: the sweep
+ * @returns:
+ *   none
+ */
+static void sweep_task(int index, void *arg) {
+    sweep_t *sw = arg;
+    int quantum = sw->quantum + index;
+    arena_t *arena = &sw->arenas[index];
+
+    /* The CPU counts and the processes were checked before the sweep started
+     */
+    sim_t *sim = sim_create(sw->cfg, quantum, sw->num_nodes);
+    arena_init(arena);
+    for (int i = 0; i < sw->num_procs; i++) {
+        process_submit(sim, context_clone(arena, sw->procs[i]));
+    }
+    process_submit_done(sim);
+
+    /* Every process is already routed, so the nodes can be simulated one after the other,
+     * unless they have to advance in lock step
+     */
+    if (sw->cfg->balance > 0) {
+        run_t run = {.sim = sim, .num_nodes = sw->num_nodes, .workers = 0, .batch = 1, .pin = sw->pin};
+        simulate_nodes(&run);
+    } else {
+        for (int node_id = 1; node_id <= sw->num_nodes; node_id++) {
+            node_simulate(sim, node_id);
+        }
+    }
+
+    size_t len;
+    FILE *row = open_memstream(&sw->rows[index], &len);
+    assert(row);
+    fprintf(row, "%8d ", quantum);
+    process_summary(sim, row);
+    fclose(row);
+
+    if (sw->keep) {
+        sw->sims[index] = sim;
+    } else {
+        process_free(sim);
+        arena_free_all(arena);
+    }
+}
+
+/* Simulate each quantum of a sweep, on a pool of workers, and output a table with a summary
+ * row for each quantum, preceded by each quantum's trace and statistics if they are kept
+ * @params:
+ *   sw: the sweep, with the processes loaded and checked
+ *   count: number of quantums
+ *   workers: number of configurations to simulate at the same time
+ * @returns:
+ *   none
+ */
+static void sweep_run(sweep_t *sw, int count, int workers) {
+    sw->sims = calloc(count, sizeof(sim_t *));
+    sw->arenas = calloc(count, sizeof(arena_t));
+    sw->rows = calloc(count, sizeof(char *));
+    assert(sw->sims && sw->arenas && sw->rows);
+
+    pool_run(workers, count, sweep_task, sw, sw->pin);
+
+    if (sw->keep) {
+        for (int i = 0; i < count; i++) {
+            printf("== quantum %d ==\n", sw->quantum + i);
+            fflush(stdout);
+            node_stats(sw->sims[i], stdout);
+            fflush(stdout);
+            process_free(sw->sims[i]);
+            arena_free_all(&sw->arenas[i]);
+        }
+    }
+
+    printf("%8s %8s %10s %8s  %s\n", "quantum", "makespan", "mean_wait", "max_wait", "node_finish");
+    for (int i = 0; i < count; i++) {
+        fputs(sw->rows[i], stdout);
+        free(sw->rows[i]);
+    }
+    free(sw->sims);
+    free(sw->arenas);
+    free(sw->rows);
+}
+
+int main(int argc, char *argv[]) {
     int num_procs;
     int quantum;
     int num_nodes;
+    int workers = 0;
+    int batch = 1;
+    int pin = 0;
+    int parse_threads = 1;
+    int arena_stats = 0;
+    int metrics = 0;
+    int quiet = 0;
+    char *binary_trace = NULL;
+    config_t cfg = {.engine = ENGINE_EVENT, .blocked = BLOCKED_QUEUE, .policy = -1, .cpus = NULL, .balance = 0,
+                    .migrate_cost = 0, .checkpoint = NULL, .checkpoint_every = 10000};
+    char *resume = NULL;
+    int ordered = 0;
+    int quantum_lo = 0;
+    int quantum_hi = 0;
+    int sweep = 0;
+    int sweep_trace = 0;
+    int trace_flags = 0;
+
+    /* Process the command line options
+     */
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--tick")) {
+            cfg.engine = ENGINE_TICK;
+        } else if (!strcmp(argv[i], "--quantum") && i + 1 < argc) {
+            int kind = parse_quantum(argv[++i], &quantum_lo, &quantum_hi);
+            if (!kind) {
+                usage(argv[0]);
+                return -1;
+            }
+            sweep = kind == 2;
+        } else if (!strcmp(argv[i], "--sweep-trace")) {
+            sweep_trace = 1;
+        } else if (!strcmp(argv[i], "--balance") && i + 1 < argc) {
+            cfg.balance = atoi(argv[++i]);
+            if (cfg.balance < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--migrate-cost") && i + 1 < argc) {
+            cfg.migrate_cost = atoi(argv[++i]);
+            if (cfg.migrate_cost < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc) {
+            cfg.checkpoint = argv[++i];
+        } else if (!strcmp(argv[i], "--checkpoint-every") && i + 1 < argc) {
+            cfg.checkpoint_every = atoi(argv[++i]);
+            if (cfg.checkpoint_every < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--resume") && i + 1 < argc) {
+            resume = argv[++i];
+        } else if (!strcmp(argv[i], "--cpus") && i + 1 < argc) {
+            cfg.cpus = argv[++i];
+        } else if (!strcmp(argv[i], "--queue") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "list")) {
+                prio_q_set_impl(PRIO_Q_LIST);
+            } else if (!strcmp(argv[i], "heap")) {
+                prio_q_set_impl(PRIO_Q_HEAP);
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--blocked") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "queue")) {
+                cfg.blocked = BLOCKED_QUEUE;
+            } else if (!strcmp(argv[i], "wheel")) {
+                cfg.blocked = BLOCKED_WHEEL;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--policy") && i + 1 < argc) {
+            cfg.policy = process_policy(argv[++i]);
+            if (cfg.policy < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--trace-order") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "interleaved")) {
+                trace_set_mode(TRACE_INTERLEAVED);
+            } else if (!strcmp(argv[i], "node")) {
+                trace_set_mode(TRACE_ORDERED);
+                ordered = 1;
+            } else {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--binary-trace") && i + 1 < argc) {
+            binary_trace = argv[++i];
+        } else if (!strcmp(argv[i], "--trace-delta")) {
+            trace_flags |= TRACE_FLAG_DELTA;
+        } else if (!strcmp(argv[i], "--pool")) {
+            workers = pool_hw_workers();
+        } else if (!strcmp(argv[i], "--workers") && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            if (workers < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            batch = atoi(argv[++i]);
+            if (batch < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--pin")) {
+            pin = 1;
+        } else if (!strcmp(argv[i], "--parse-threads") && i + 1 < argc) {
+            parse_threads = atoi(argv[++i]);
+            if (parse_threads < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--arena-stats")) {
+            arena_stats = 1;
+        } else if (!strcmp(argv[i], "--metrics")) {
+            metrics = 1;
+        } else if (!strcmp(argv[i], "--quiet")) {
+            quiet = 1;
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (sweep) {
+        if (cfg.checkpoint || resume) {
+            fprintf(stderr, "--checkpoint and --resume cannot be used with a range of quantums\n");
+            return -1;
+        } else if (metrics || arena_stats) {
+            fprintf(stderr, "--metrics and --arena-stats report on a single run, they cannot be used with a range of quantums\n");
+            return -1;
+        }
+        // The configurations are simulated side by side, traced only if asked to
+        trace_set_mode(sweep_trace ? TRACE_ORDERED : TRACE_OFF);
+        workers = workers > 0 ? workers : pool_hw_workers();
+    } else if ((cfg.balance > 0 || cfg.checkpoint) && (workers > 0 || batch > 1)) {
+        fprintf(stderr, "--balance and --checkpoint need one thread per node, they cannot be used with --pool, --workers "
+                        "or --batch\n");
+        return -1;
+    } else if (cfg.checkpoint && ordered) {
+        fprintf(stderr, "--checkpoint writes the trace out at each snapshot, it cannot be used with --trace-order node\n");
+        return -1;
+    } else if (quiet && (cfg.checkpoint || resume || binary_trace || ordered)) {
+        fprintf(stderr, "--quiet writes no trace and keeps no finished processes, it cannot be used with --checkpoint, "
+                        "--resume, --binary-trace or --trace-order\n");
+        return -1;
+    }
+    if (quiet) {
+        trace_set_mode(TRACE_OFF);
+    }
+
+    if (binary_trace && !trace_open_binary(binary_trace, trace_flags)) {
+        perror(binary_trace);
+        return -1;
+    }
 
     /* Read in the header of the process description with minimal validation
     */
-    if (scanf("%d %d %d", &num_procs, &quantum, &num_nodes) < 3) {
+    arena_t arena;
+    arena_init(&arena);
+    loader_t *loader = loader_open(stdin, &arena);
+    if (!loader_header(loader, &num_procs, &quantum, &num_nodes)) {
         fprintf(stderr, "Bad input, expecting number of processes, quantum size, and number of nodes\n");
         return -1;
     }
+    if (quantum_lo > 0) {
+        quantum = quantum_lo;
+    }
 
-    /* We use an array of pointers to contexts to track the processes.
-    */
-    context **procs = calloc(num_procs, sizeof(context *));
+    /* The header may name the scheduling policy, unless it is given on the command line
+     */
+    char policy[16];
+    if (loader_header_word(loader, policy, sizeof(policy) - 1)) {
+        int named = process_policy(policy);
+        if (named < 0) {
+            fprintf(stderr, "Bad input, unknown scheduling policy %s in the header\n", policy);
+            return -1;
+        }
+        cfg.policy = cfg.policy < 0 ? named : cfg.policy;
+    }
+    cfg.policy = cfg.policy < 0 ? POLICY_PRIORITY : cfg.policy;
 
-    process_init(quantum, num_nodes);
+    sim_t *sim = sim_create(&cfg, quantum, num_nodes);
+    if (!sim) {
+        fprintf(stderr, "Bad CPU counts %s, expecting counts from 1 to %d\n", cfg.cpus, PROCESS_CPUS_MAX);
+        return -1;
+    }
 
-    /* Load and admit each process, if an error occurs, we just give up.
+    /* The statistics are written out as the simulation goes, unless the trace is held back until the end
      */
+    int stream = !sweep && !ordered && !quiet;
+    if (stream) {
+        process_set_stream(sim, stdout, release_context, loader);
+    } else if (quiet) {
+        process_set_quiet(sim, release_context, loader);
+    }
+
+    /* Start simulating right away, the nodes admit their processes as they are routed to them.
+     * A sweep has to load the whole workload first, and only uses sim to check the routing.
+     * Resuming also loads the whole workload first, to put the processes in the snapshot back on their nodes.
+     */
+    pthread_t simulation;
+    run_t run = {.sim = sim, .num_nodes = num_nodes, .workers = workers, .batch = batch, .pin = pin};
+    if (!sweep && !resume) {
+        pthread_create(&simulation, NULL, simulate_nodes, &run);
+    }
+
+    /* Load each process and route it to its node, if an error occurs, we just give up.
+     * With parser threads, the whole workload is loaded first, into an array of pointers to contexts.
+     */
+    context **procs = NULL;
+    if (parse_threads > 1 || sweep || resume) {
+        procs = arena_alloc(&arena, num_procs * sizeof(context *));
+        if (!loader_load_all(loader, procs, num_procs, parse_threads)) {
+            fprintf(stderr, "Bad input, could not load program description\n");
+            return -1;
+        }
+    }
+    if (resume) {
+        FILE *snapshot = fopen(resume, "rb");
+        if (!snapshot) {
+            perror(resume);
+            return -1;
+        }
+        if (!process_restore(sim, snapshot, procs, num_procs)) {
+            fprintf(stderr, "Bad snapshot %s, or it was not taken of this workload with these settings\n", resume);
+            return -1;
+        }
+        fclose(snapshot);
+        pthread_create(&simulation, NULL, simulate_nodes, &run);
+    }
     for (int i = 0; i < num_procs; i++) {
-        procs[i] = context_load(stdin);
-        if (!procs[i]) {
+        context *proc = procs ? procs[i] : loader_next(loader);
+        if (proc && proc->state != PROC_NEW) {
+            // Restored from the snapshot, the process is already on its node
+            continue;
+        }
+        if (!proc) {
+            fprintf(stderr, "Bad input, could not load program description\n");
+            return -1;
+        }
+        proc->cold->index = i;
+        if (!process_submit(sim, proc)) {
             fprintf(stderr, "Bad input, could not load program description\n");
             return -1;
         }
-        process_admit(procs[i]);
+        if (stream && i % STREAM_EVERY == STREAM_EVERY - 1) {
+            process_stream(sim, 0);
+        }
     }
+    process_submit_done(sim);
 
-    // Creating threads for each node
-    pthread_t threads[num_nodes];
-    int node_ids[num_nodes];
-
-    // launching simulation for each node by calling node_simulate
-    for (int i = 0; i < num_nodes; i++) {
-        node_ids[i] = i + 1;
-        pthread_create(&threads[i], NULL, node_simulate, &node_ids[i]);
+    if (sweep) {
+        process_free(sim);
+        sweep_t sw = {.cfg = &cfg, .procs = procs, .num_procs = num_procs, .num_nodes = num_nodes,
+                      .quantum = quantum_lo, .keep = sweep_trace, .pin = pin};
+        loader_close(loader);
+        sweep_run(&sw, quantum_hi - quantum_lo + 1, workers);
+        trace_close();
+        program_free_all();
+        arena_free_all(&arena);
+        return 0;
     }
 
-    // waiting for all threads to complete execution
-    for (int i = 0; i < num_nodes; i++) {
-        pthread_join(threads[i], NULL);
+    if (stream) {
+        process_stream(sim, 1);
     }
+    pthread_join(simulation, NULL);
+    loader_close(loader);
 
-    /* Output the statistics for processes in order of Finishing.
+    /* Output the statistics for processes in order of Finishing, or only their distributions
      */
-    node_stats(stdout);
+    if (quiet) {
+        process_distributions(sim, stdout);
+    } else {
+        node_stats(sim, stdout);
+    }
+    trace_close();
+
+    if (metrics && !process_metrics(sim, stdout)) {
+        fprintf(stderr, "--metrics: counters were compiled out, rebuild with PROSIM_METRICS=1\n");
+    }
 
-    free(procs);
+    if (arena_stats) {
+        arena_report(&arena, "contexts", stderr);
+        program_report(stderr);
+        process_report(sim, stderr);
+    }
+
+    /* Tear down the run: every context, program and queue node lives in an arena
+     */
+    process_free(sim);
+    program_free_all();
+    arena_free_all(&arena);
 
     return 0;
-}
\ No newline at end of file
+}
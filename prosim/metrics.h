@@ -0,0 +1,72 @@
+//
+// Per-node counters of what node_simulate spends its time on, reported with --metrics.
+// Building with PROSIM_METRICS=0 compiles them out of the simulation loop altogether.
+//
+
+#ifndef PROSIM_METRICS_H
+#define PROSIM_METRICS_H
+
+#ifndef PROSIM_METRICS
+#define PROSIM_METRICS 1
+#endif
+
+#if PROSIM_METRICS
+#include <time.h>
+
+/* Traffic through one of a node's queues
+ */
+typedef struct queue_metrics {
+    unsigned long long inserts;
+    unsigned long long removes;
+    int depth;                      /* current number of entries */
+    int max_depth;                  /* largest number of entries */
+} queue_metrics_t;
+
+/* A node's counters, only touched by the thread simulating the node
+ */
+typedef struct node_metrics {
+    unsigned long long iterations;  /* passes through the simulation loop */
+    unsigned long long idle_ticks;  /* CPU ticks in which the CPU had no process running */
+    unsigned long long preemptions; /* running processes preempted by an arriving or unblocked one */
+    unsigned long long steals;      /* processes an idle CPU took from a sibling's ready queue */
+    unsigned long long migrations;  /* processes the balancer moved away from the node */
+    queue_metrics_t ready;
+    queue_metrics_t blocked;
+    double start;                   /* monotonic time at which the node thread started */
+    double wall;                    /* seconds the node thread ran for */
+} node_metrics_t;
+
+static inline double metrics_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void metrics_queue_add(queue_metrics_t *q) {
+    q->inserts++;
+    if (++q->depth > q->max_depth) {
+        q->max_depth = q->depth;
+    }
+}
+
+static inline void metrics_queue_remove(queue_metrics_t *q) {
+    q->removes++;
+    q->depth--;
+}
+
+/* The macros take a pointer to a struct with a node_metrics_t member named metrics
+ */
+#define METRIC_ADD(owner, field, n) ((owner)->metrics.field += (n))
+#define METRIC_QUEUE_ADD(owner, queue) metrics_queue_add(&(owner)->metrics.queue)
+#define METRIC_QUEUE_REMOVE(owner, queue) metrics_queue_remove(&(owner)->metrics.queue)
+#define METRIC_TIMER_START(owner) ((owner)->metrics.start = metrics_now())
+#define METRIC_TIMER_STOP(owner) ((owner)->metrics.wall = metrics_now() - (owner)->metrics.start)
+#else
+#define METRIC_ADD(owner, field, n) ((void) 0)
+#define METRIC_QUEUE_ADD(owner, queue) ((void) 0)
+#define METRIC_QUEUE_REMOVE(owner, queue) ((void) 0)
+#define METRIC_TIMER_START(owner) ((void) 0)
+#define METRIC_TIMER_STOP(owner) ((void) 0)
+#endif
+
+#endif //PROSIM_METRICS_H
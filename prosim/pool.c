@@ -0,0 +1,158 @@
+//
+// Fixed size worker pool with per-worker deques and work stealing.
+//
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+#include "affinity.h"
+
+/* Each worker owns a deque of task indices.  The owner takes from the back and thieves take
+ * from the front.  Tasks are whole node simulations, so a mutex per deque is cheap enough.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    int *tasks;           /* task indices, the live ones are tasks[head .. tail - 1] */
+    int head;             /* index of the front of the deque */
+    int tail;             /* one past the back of the deque */
+} deque_t;
+
+typedef struct {
+    deque_t *deques;      /* one deque per worker */
+    int workers;          /* number of workers */
+    pool_task_fn task;    /* function to run for each task */
+    void *arg;            /* argument passed to each task */
+    int pin;              /* whether each worker is pinned to a CPU */
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    int id;               /* index of the worker and of its deque */
+} worker_t;
+
+/* Returns the number of workers matching the hardware concurrency
+ * @params:
+ *   none
+ * @returns:
+ *   number of online CPUs, at least 1
+ */
+extern int pool_hw_workers() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : (int) n;
+}
+
+/* Takes a task from the back of the worker's own deque
+ * @params:
+ *   dq: worker's deque
+ * @returns:
+ *   task index or -1 if the deque is empty
+ */
+static int pop_back(deque_t *dq) {
+    int index = -1;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        index = dq->tasks[--dq->tail];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return index;
+}
+
+/* Steals a task from the front of another worker's deque
+ * @params:
+ *   dq: victim's deque
+ * @returns:
+ *   task index or -1 if the deque is empty
+ */
+static int pop_front(deque_t *dq) {
+    int index = -1;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        index = dq->tasks[dq->head++];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return index;
+}
+
+/* Worker thread: drain the own deque, then steal until every deque is empty.
+ * No new tasks are created while the pool runs, so once a full sweep of the
+ * deques finds nothing the worker is done.
+ * @params:
+ *   arg: pointer to the worker_t
+ * @returns:
+ *   NULL
+ */
+static void *worker_main(void *arg) {
+    worker_t *self = arg;
+    pool_t *pool = self->pool;
+
+    if (pool->pin) {
+        affinity_pin(self->id);
+    }
+    for (;;) {
+        int index = pop_back(&pool->deques[self->id]);
+        for (int i = 1; index < 0 && i < pool->workers; i++) {
+            index = pop_front(&pool->deques[(self->id + i) % pool->workers]);
+        }
+        if (index < 0) {
+            break;
+        }
+        pool->task(index, pool->arg);
+    }
+    return NULL;
+}
+
+/* Runs tasks 0 .. count - 1 on a pool of worker threads and waits for all of them to finish.
+ * @params:
+ *   workers: number of worker threads, capped at count
+ *   count: number of tasks
+ *   task: function called once for each task index
+ *   arg: passed to every call of task
+ *   pin: if set, each worker is pinned to a CPU with affinity_pin, by its index
+ * @returns:
+ *   none
+ */
+extern void pool_run(int workers, int count, pool_task_fn task, void *arg, int pin) {
+    if (workers > count) {
+        workers = count;
+    }
+    if (workers < 1) {
+        return;
+    }
+
+    pool_t pool = {calloc(workers, sizeof(deque_t)), workers, task, arg, pin};
+    worker_t *self = calloc(workers, sizeof(worker_t));
+    pthread_t *threads = calloc(workers, sizeof(pthread_t));
+    assert(pool.deques && self && threads);
+
+    /* Deal the tasks round-robin.  Workers run their own deque from the back, so the tasks
+     * are stored in reverse to have each worker start with its lowest index.
+     */
+    for (int w = 0; w < workers; w++) {
+        deque_t *dq = &pool.deques[w];
+        pthread_mutex_init(&dq->lock, NULL);
+        dq->tasks = malloc((count / workers + 1) * sizeof(int));
+        assert(dq->tasks);
+        for (int i = w + (count - 1 - w) / workers * workers; i >= 0; i -= workers) {
+            dq->tasks[dq->tail++] = i;
+        }
+    }
+
+    for (int w = 0; w < workers; w++) {
+        self[w].pool = &pool;
+        self[w].id = w;
+        pthread_create(&threads[w], NULL, worker_main, &self[w]);
+    }
+    for (int w = 0; w < workers; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    for (int w = 0; w < workers; w++) {
+        pthread_mutex_destroy(&pool.deques[w].lock);
+        free(pool.deques[w].tasks);
+    }
+    free(pool.deques);
+    free(self);
+    free(threads);
+}
@@ -0,0 +1,35 @@
+//
+// Fixed size worker pool with per-worker deques and work stealing.
+//
+
+#ifndef PROSIM_POOL_H
+#define PROSIM_POOL_H
+
+/* A task is identified by its index, the argument is shared by all tasks of a run
+ */
+typedef void (*pool_task_fn)(int index, void *arg);
+
+/* Returns the number of workers matching the hardware concurrency
+ * @params:
+ *   none
+ * @returns:
+ *   number of online CPUs, at least 1
+ */
+extern int pool_hw_workers();
+
+/* Runs tasks 0 .. count - 1 on a pool of worker threads and waits for all of them to finish.
+ * Tasks are dealt round-robin into the workers' deques.  A worker runs the tasks in its own
+ * deque from the back and, once it is empty, steals from the front of the other workers' deques,
+ * so long tasks do not hold up the short ones queued behind them.
+ * @params:
+ *   workers: number of worker threads, capped at count
+ *   count: number of tasks
+ *   task: function called once for each task index
+ *   arg: passed to every call of task
+ *   pin: if set, each worker is pinned to a CPU with affinity_pin, by its index
+ * @returns:
+ *   none
+ */
+extern void pool_run(int workers, int count, pool_task_fn task, void *arg, int pin);
+
+#endif //PROSIM_POOL_H
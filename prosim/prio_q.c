@@ -7,6 +7,22 @@
 #include <assert.h>
 #include "prio_q.h"
 
+/* Number of children of each node in the heap
+ */
+#define HEAP_D 4
+
+static int default_impl = PRIO_Q_HEAP;
+
+/* Selects the implementation used by subsequent calls to prio_q_new()
+ * @params:
+ *   impl : PRIO_Q_HEAP (default) or PRIO_Q_LIST
+ * @returns:
+ *   none
+ */
+extern void prio_q_set_impl(int impl) {
+    default_impl = impl;
+}
+
 /* Creates an empty priority queue and returns a pointer to it.
  * @params:
  *   none
@@ -14,11 +30,109 @@
  *   pointer to the new priority queue or NULL if an error has occurred
  */
 extern prio_q_t *prio_q_new() {
-    prio_q_t *list = calloc(1, sizeof(prio_q_t));
-    assert(list != NULL);
+    return prio_q_new_in(NULL);
+}
+
+/* Creates an empty priority queue whose memory is allocated from an arena and freed with it.
+ * @params:
+ *   arena : arena from which to allocate the queue
+ * @returns:
+ *   pointer to the new priority queue
+ */
+extern prio_q_t *prio_q_new_in(arena_t *arena) {
+    prio_q_t *list = arena_alloc(arena, sizeof(prio_q_t));
+    list->impl = default_impl;
+    list->arena = arena;
     return list;
 }
 
+/* Returns true if heap entry a should be removed before heap entry b
+ * @params:
+ *   a, b : pointers to heap entries
+ * @returns:
+ *   1 if a has a lower priority value, or the same priority and was inserted earlier, 0 otherwise
+ */
+static inline int heap_before(heap_entry_t *a, heap_entry_t *b) {
+    return a->priority < b->priority || (a->priority == b->priority && a->seq < b->seq);
+}
+
+/* Enqueues an item into the heap, sifting it up from the last slot
+ * @params:
+ *   queue : pointer to the priority queue
+ *   contents : pointer to item to be enqueued
+ *   priority : item's priority
+ * @returns:
+ *   none
+ */
+static void heap_add(prio_q_t *queue, void *contents, int priority) {
+    /* Grow the array geometrically and assume the allocation is successful.
+     * An arena cannot resize in place, so the old array is left to be freed with the arena.
+     */
+    if (queue->size == queue->capacity) {
+        queue->capacity = queue->capacity ? 2 * queue->capacity : 16;
+        if (queue->arena) {
+            heap_entry_t *bigger = arena_alloc(queue->arena, queue->capacity * sizeof(heap_entry_t));
+            if (queue->size > 0) {
+                memcpy(bigger, queue->heap, queue->size * sizeof(heap_entry_t));
+            }
+            queue->heap = bigger;
+        } else {
+            queue->heap = realloc(queue->heap, queue->capacity * sizeof(heap_entry_t));
+            assert(queue->heap != NULL);
+        }
+    }
+
+    heap_entry_t entry = {priority, queue->next_seq++, contents};
+    int i = queue->size++;
+    while (i > 0) {
+        int parent = (i - 1) / HEAP_D;
+        if (!heap_before(&entry, &queue->heap[parent])) {
+            break;
+        }
+        queue->heap[i] = queue->heap[parent];
+        i = parent;
+    }
+    queue->heap[i] = entry;
+}
+
+/* Removes and returns the item at the root of the heap, sifting the last entry down into its place
+ * @params:
+ *   queue : pointer to the priority queue
+ * @returns:
+ *   pointer to the item
+ */
+static void *heap_remove(prio_q_t *queue) {
+    void *contents = queue->heap[0].contents;
+    heap_entry_t last = queue->heap[--queue->size];
+    int n = queue->size;
+    int i = 0;
+
+    for (;;) {
+        /* Find the child that should be removed first, if any
+         */
+        int first = HEAP_D * i + 1;
+        if (first >= n) {
+            break;
+        }
+        int best = first;
+        int end = first + HEAP_D < n ? first + HEAP_D : n;
+        for (int c = first + 1; c < end; c++) {
+            if (heap_before(&queue->heap[c], &queue->heap[best])) {
+                best = c;
+            }
+        }
+        if (!heap_before(&queue->heap[best], &last)) {
+            break;
+        }
+        queue->heap[i] = queue->heap[best];
+        i = best;
+    }
+    if (n > 0) {
+        queue->heap[i] = last;
+    }
+    return contents;
+}
+
 /* Allocate a new node to be inserted into queue and initialize it.
  * @params:
  *   queue : pointer to the priority queue
@@ -35,7 +149,7 @@ static node_t *new_node(prio_q_t *queue, void *contents, int priority) {
      */
     node_t *node = queue->free;
     if (!node) {
-        node = calloc(1, sizeof(node_t));
+        node = arena_alloc(queue->arena, sizeof(node_t));
     } else {
         queue->free = queue->free->next;
         memset(node, 0, sizeof(node_t));
@@ -58,6 +172,11 @@ static node_t *new_node(prio_q_t *queue, void *contents, int priority) {
  *   none
  */
 extern void prio_q_add(prio_q_t *list, void *contents, int priority) {
+    if (list->impl == PRIO_Q_HEAP) {
+        heap_add(list, contents, priority);
+        return;
+    }
+
     /* Assume we successfully allocate a new node
      */
     node_t *node = new_node(list, contents, priority);
@@ -95,6 +214,9 @@ extern void prio_q_add(prio_q_t *list, void *contents, int priority) {
  */
 extern int prio_q_empty(prio_q_t *list) {
     assert(list != NULL);
+    if (list->impl == PRIO_Q_HEAP) {
+        return list->size == 0;
+    }
     return list->head == NULL;
 }
 
@@ -106,6 +228,10 @@ extern int prio_q_empty(prio_q_t *list) {
  */
 extern void *prio_q_remove(prio_q_t *list) {
     assert(list != NULL);
+    if (list->impl == PRIO_Q_HEAP) {
+        assert(list->size > 0);
+        return heap_remove(list);
+    }
     assert(list->head != NULL);
 
     node_t *node = list->head;
@@ -131,6 +257,10 @@ extern void *prio_q_remove(prio_q_t *list) {
  */
 extern void *prio_q_peek(prio_q_t *list) {
     assert(list != NULL);
+    if (list->impl == PRIO_Q_HEAP) {
+        assert(list->size > 0);
+        return list->heap[0].contents;
+    }
     assert(list->head != NULL);
 
     return list->head->contents;
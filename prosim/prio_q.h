@@ -5,13 +5,23 @@
 #ifndef PRIO_Q_H
 #define PRIO_Q_H
 
-/* This is a singly linked-list implementation of a priority queue, nothing special
+#include "arena.h"
+
+/* A priority queue with two interchangeable implementations, nothing special
  * Items are kept in priority order where lower value is a higher priority.
  * I.e., the head of the queue has the lowest priority
  * Ties are broken by order of instertions into queue.
  * The priority queue stores pointers to the item and does not make a copy of the item
- * Instead of freeing nodes, the nodes are kept in a list to be reused.
+ *
+ * PRIO_Q_HEAP: an array based 4-ary heap, O(log n) add and remove.  Each item is tagged with an
+ *   insertion sequence number so that ties are still broken in FIFO order.
+ * PRIO_Q_LIST: a sorted singly linked-list, O(1) add at either end and O(n) in the middle.
+ *   Instead of freeing nodes, the nodes are kept in a list to be reused.
  */
+enum {
+    PRIO_Q_HEAP = 0,
+    PRIO_Q_LIST
+};
 
 typedef struct node {
     struct node *next;    /* pointer to next node in the list */
@@ -19,12 +29,32 @@ typedef struct node {
     void *contents;       /* pointer to item */
 } node_t;
 
+typedef struct heap_entry {
+    int priority;         /* priority of item in the queue */
+    unsigned long long seq; /* insertion sequence number, used to break ties */
+    void *contents;       /* pointer to item */
+} heap_entry_t;
+
 typedef struct prio_q {
+    int impl;             /* PRIO_Q_HEAP or PRIO_Q_LIST */
+    arena_t *arena;       /* arena from which nodes and the heap are allocated, or NULL to use the heap */
     node_t *head;         /* pointer to head node in list or null if empty */
     node_t *tail;         /* pointer to tail node in list of null if empty */
     node_t *free;         /* singly linked list of nodes that can be reused */
+    heap_entry_t *heap;   /* array of heap entries */
+    int size;             /* number of entries in the heap */
+    int capacity;         /* number of entries allocated for the heap */
+    unsigned long long next_seq; /* sequence number of the next item added to the heap */
 } prio_q_t;
 
+/* Selects the implementation used by subsequent calls to prio_q_new()
+ * @params:
+ *   impl : PRIO_Q_HEAP (default) or PRIO_Q_LIST
+ * @returns:
+ *   none
+ */
+extern void prio_q_set_impl(int impl);
+
 /* Creates an empty priority queue and returns a pointer to it.
  * @params:
  *   none
@@ -33,6 +63,14 @@ typedef struct prio_q {
  */
 extern prio_q_t *prio_q_new();
 
+/* Creates an empty priority queue whose memory is allocated from an arena and freed with it.
+ * @params:
+ *   arena : arena from which to allocate the queue
+ * @returns:
+ *   pointer to the new priority queue
+ */
+extern prio_q_t *prio_q_new_in(arena_t *arena);
+
 /* Enqueues an item into the priority queue
  * @params:
  *   queue : pointer to the priority queue
@@ -4,78 +4,521 @@
 
 #include "process.h"
 #include "prio_q.h"
-#include <pthread.h>
+#include "trace.h"
+#include "arena.h"
+#include "inbox.h"
+#include "wheel.h"
+#include "hist.h"
+#include "metrics.h"
+#include <string.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+typedef struct node_data node_data_t;
+
+/* Distributions of the times of a node's finished processes, in quiet mode
+ */
+typedef struct {
+    hist_t wait;                /* time spent in ready queues */
+    hist_t block;               /* time spent blocked */
+    hist_t turnaround;          /* time from arrival to finishing */
+    hist_t response;            /* time from arrival to first running, for processes that ran */
+} dist_t;
+
+/* How long process_stream sleeps between looks at the nodes' clocks
+ */
+#define STREAM_POLL_US 5000
+
+/* Ticks the nodes of a group simulated by node_simulate_batch advance by before the group moves on
+ */
+#define BATCH_WINDOW 256
+
+/* Levels of the multilevel feedback queue, the quantum doubles at each level down
+ */
+#define MLFQ_LEVELS 4
+
+/* Quantum of the policies that let a process run until its DOOP is done
+ */
+#define NO_QUANTUM INT_MAX
+
+/* FNV-1a hashing, of the processes admitted to the nodes and of snapshots
+ */
+#define FNV_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+/* The functions of the simulation loop that depend on the scheduling policy take it as an argument and are
+ * inlined into a copy of the loop for each policy, see node_runs, in which the policy is then a constant
+ */
+#define POLICY_INLINE static inline __attribute__((always_inline))
+
+/* A node's finished processes on their way to the statistics, when streaming.  The node thread
+ * hands its processes over in finishing order, and whoever writes out the statistics picks them up.
+ */
+typedef struct {
+    atomic_int clock;           /* every process finishing before this clock has been handed over */
+    pthread_mutex_t lock;       /* protects handoff */
+    context **handoff;          /* handed over by the node, not picked up yet */
+    int handoff_count;
+    int handoff_cap;
+    context **pending;          /* picked up, waiting for the watermark to pass their finish time */
+    int pending_count;
+    int pending_cap;
+} stream_t;
+
+/* A simulated CPU of a node, with its own running slot and ready queue
+ */
+typedef struct {
+    context *cur;               /* process running on the CPU, or NULL */
+    int quantum;                /* quantum left for cur */
+    int preempt;                /* cur is to be preempted by a process that became ready this tick */
+    prio_q_t *ready;            /* processes waiting for this CPU */
+    int queued;                 /* number of processes in ready */
+} cpu_t;
 
 /* This struct is used as the datastructure for each node
  * helps in creating seperate queue for each node
  * Improves code readability and provides better error handling
+ * Nodes are cache line aligned, and what other threads touch while the node is simulated, its inbox and
+ * stream, is on cache lines of its own, so that no line is written by one thread while another uses it.
 */
-typedef struct {
-    prio_q_t *blocked;
-    prio_q_t *ready;
+struct node_data {
+    sim_t *sim;                 /* simulation the node is part of */
+    prio_q_t *blocked;          /* blocked processes, by wake-up time, unless the simulation uses a wheel */
+    wheel_t *wheel;             /* blocked processes, if the simulation uses a timing wheel */
+    prio_q_t *transit;          /* processes migrating to this node, by the time they get here */
+    int incoming;               /* number of processes in transit */
+    cpu_t *cpus;                /* the node's CPUs */
+    int num_cpus;               /* number of CPUs */
+    int queued;                 /* number of processes in the CPUs' ready queues */
+    int running;                /* number of CPUs running a process */
     int node_clock;
     int next_proc_id;
     int node_id;
-    int finish_time;
-} node_data_t;
-
-static node_data_t *nodes;
-static int num_nodes;
-static int quantum;
-
-// Mutex lock to prevent race condition on finished queue* (shared with all the threads).
-static pthread_mutex_t finished_mutex = PTHREAD_MUTEX_INITIALIZER;
-static prio_q_t *finished;
-
-enum {
-    PROC_NEW = 0,
-    PROC_READY,
-    PROC_RUNNING,
-    PROC_BLOCKED,
-    PROC_FINISHED
+    int finish_time;            /* time at which the last process finished, in quiet mode */
+    int vclock;                 /* virtual runtime of the latest process to run, for the fair share policy */
+    unsigned int fingerprint;   /* hash of the processes admitted so far, kept when taking snapshots */
+    unsigned long long busy_ticks;  /* CPU ticks spent running processes */
+    dist_t *dist;               /* distributions of the finished processes, in quiet mode */
+    trace_buf_t trace;
+    context **finished;         /* processes finished on this node, in finishing order, when streaming only
+                                 * those that have not been handed over yet */
+    int finished_count;         /* number of processes in finished */
+    int finished_cap;           /* number of slots allocated for finished */
+    arena_t arena;              /* memory of the node's queues, trace buffer and finished list */
+    int window_end;             /* clock at which the node next waits at the window barrier */
+    int horizon;                /* every process arriving before this clock has been routed to the node, when it is
+                                 * run by node_run_until, so it need not wait for them */
+    int started;                /* node_run_until has started simulating the node */
+    int done;                   /* node_run_until has wrapped up the simulation of the node */
+#if PROSIM_METRICS
+    node_metrics_t metrics;     /* hot path counters, reported by process_metrics */
+#endif
+    inbox_t inbox;              /* processes routed to this node, in input order */
+    int last_arrival;           /* arrival time of the last process routed to this node */
+    _Alignas(CACHE_LINE) stream_t stream;   /* finished processes handed over to the statistics, when streaming */
+};
+
+/* A simulation: its nodes and configuration.  Each simulation is independent of the others,
+ * so several can be run at the same time.  The settings the node threads read at every tick are kept
+ * apart from what the thread routing the processes and the thread writing out the statistics write.
+ */
+struct sim {
+    node_data_t *nodes;
+    int num_nodes;
+    int quantum;
+    int engine;
+    int blocked_impl;           /* BLOCKED_QUEUE or BLOCKED_WHEEL */
+    int policy;                 /* one of PROCESS_POLICIES */
+    /* Every window ticks all nodes meet at the window barrier, and the last one to arrive
+     * migrates processes between them, if balancing, and writes a snapshot, if one is due
+     */
+    int window;
+    int balance_interval;
+    int migrate_cost;
+    int checkpoint_interval;
+    int next_checkpoint;        /* clock from which the next snapshot is due */
+    const char *checkpoint_path;
+    pthread_barrier_t window_barrier;
+    int all_done;               /* no node has anything left to simulate, set at the barrier */
+    /* When streaming, the statistics of each process are written out once every node's clock has passed
+     * its finish time, and its context is then released
+     */
+    FILE *stream_out;
+    void (*release)(void *arg, context *proc);
+    void *release_arg;
+    _Alignas(CACHE_LINE) arena_t submit_arena;  /* inbox cells and contexts made by process_create, allocated by the
+                                                 * thread routing processes to the nodes */
+    int created;                /* number of processes made by process_create */
+    _Alignas(CACHE_LINE) pthread_mutex_t stream_lock;   /* held while the statistics are written out */
+    context ***stream_lists;    /* scratch space for merging the nodes' pending processes */
+    int *stream_counts;
+    int *stream_pos;
 };
 
-static char *states[] = {"new", "ready", "running", "blocked", "finished"};
+/* Give a node a number of CPUs, each with an empty ready queue
+ * @params:
+ *   node: node to set up
+ *   count: number of CPUs
+ * @returns:
+ *   none
+ */
+static void cpus_init(node_data_t *node, int count) {
+    node->cpus = arena_alloc(&node->arena, count * sizeof(cpu_t));
+    for (int c = 0; c < count; c++) {
+        node->cpus[c].ready = prio_q_new_in(&node->arena);
+    }
+    node->num_cpus = count;
+}
 
 /* Initialize the simulation
  * @params:
  *   quantum: the CPU quantum to use in the situation
  *   node_count: The number of nodes available for
  * @returns:
- *   returns 1
+ *   the new simulation
  */
-extern int process_init(int cpu_quantum, int node_count) {
+extern sim_t *process_init(int cpu_quantum, int node_count) {
     /* Set up the queues for each node, store the quantum, and store the node_count
      * Assume the queues will be allocated
      */
-    quantum = cpu_quantum;
-    num_nodes = node_count;
+    sim_t *sim = arena_alloc_aligned(NULL, sizeof(sim_t), CACHE_LINE);
+    sim->quantum = cpu_quantum;
+    sim->num_nodes = node_count;
+    sim->engine = ENGINE_EVENT;
 
-    nodes = malloc(num_nodes * sizeof(node_data_t));
-    for (int i = 0; i < num_nodes; i++) {
-        nodes[i].blocked = prio_q_new();
-        nodes[i].ready = prio_q_new();
+    node_data_t *nodes = sim->nodes = arena_alloc_aligned(NULL, node_count * sizeof(node_data_t), CACHE_LINE);
+    for (int i = 0; i < node_count; i++) {
+        nodes[i].sim = sim;
+        arena_init(&nodes[i].arena);
+        nodes[i].blocked = prio_q_new_in(&nodes[i].arena);
+        nodes[i].transit = prio_q_new_in(&nodes[i].arena);
+        cpus_init(&nodes[i], 1);
         nodes[i].node_clock = 0;
         nodes[i].next_proc_id = 1;
         nodes[i].node_id = i + 1;
+        nodes[i].fingerprint = FNV_BASIS;
+        trace_init(&nodes[i].trace);
+        inbox_init(&nodes[i].inbox, arena_alloc(&nodes[i].arena, sizeof(inbox_cell_t)));
+        atomic_init(&nodes[i].stream.clock, 0);
+        pthread_mutex_init(&nodes[i].stream.lock, NULL);
     }
+    pthread_mutex_init(&sim->stream_lock, NULL);
+    return sim;
+}
 
-    // Initializing shared queue for finished processes
-    // shared queue
-    finished = prio_q_new();
+/* Set the number of CPUs of a node, must be called before the node is simulated
+ * @params:
+ *   sim: simulation
+ *   node_id: node number, starting at 1
+ *   count: number of CPUs, 1 to PROCESS_CPUS_MAX
+ * @returns:
+ *   1 on success, 0 if the node or count is out of range
+ */
+extern int process_set_cpus(sim_t *sim, int node_id, int count) {
+    if (node_id < 1 || node_id > sim->num_nodes || count < 1 || count > PROCESS_CPUS_MAX) {
+        return 0;
+    }
+    cpus_init(&sim->nodes[node_id - 1], count);
     return 1;
 }
 
+/* Make the nodes meet at the window barrier every so many ticks, unless they already do
+ * @params:
+ *   sim: simulation
+ *   window: ticks between meetings
+ * @returns:
+ *   none
+ */
+static void set_window(sim_t *sim, int window) {
+    if (sim->window > 0) {
+        return;
+    }
+    sim->window = window;
+    for (int i = 0; i < sim->num_nodes; i++) {
+        sim->nodes[i].window_end = window;
+    }
+    pthread_barrier_init(&sim->window_barrier, NULL, sim->num_nodes);
+}
+
+/* Turn on cross-node balancing, must be called before the nodes are simulated.  The nodes then
+ * advance in lock step windows and must all be simulated at the same time, one thread per node,
+ * or all of them on one thread by process_run_until.
+ * @params:
+ *   sim: simulation
+ *   interval: ticks between balancing rounds, at least 1
+ *   cost: ticks a process spends moving to another node
+ * @returns:
+ *   none
+ */
+extern void process_set_balance(sim_t *sim, int interval, int cost) {
+    sim->balance_interval = interval;
+    sim->migrate_cost = cost;
+    set_window(sim, interval);
+}
+
+/* Take a snapshot of the simulation every so often, must be called before the nodes are simulated
+ * and after process_set_balance, whose window the snapshots are then taken at the end of.  The nodes then advance
+ * in lock step windows and must all be simulated at the same time, one thread per node, or all of them on one
+ * thread by process_run_until.
+ * @params:
+ *   sim: simulation
+ *   path: file to which the snapshots are written, each replacing the previous one
+ *   interval: ticks between snapshots, at least 1
+ * @returns:
+ *   none
+ */
+extern void process_set_checkpoint(sim_t *sim, const char *path, int interval) {
+    sim->checkpoint_path = path;
+    sim->checkpoint_interval = interval;
+    sim->next_checkpoint = interval;
+    set_window(sim, interval);
+}
+
+/* Select how node_simulate advances the node clock
+ * @params:
+ *   sim: simulation
+ *   mode: ENGINE_EVENT or ENGINE_TICK
+ * @returns:
+ *   none
+ */
+extern void process_set_engine(sim_t *sim, int mode) {
+    sim->engine = mode;
+}
+
+/* Select how each node holds its blocked processes, must be called before any process is admitted
+ * @params:
+ *   sim: simulation
+ *   impl: BLOCKED_QUEUE (default) or BLOCKED_WHEEL
+ * @returns:
+ *   none
+ */
+extern void process_set_blocked(sim_t *sim, int impl) {
+    sim->blocked_impl = impl;
+    for (int i = 0; i < sim->num_nodes; i++) {
+        node_data_t *node = &sim->nodes[i];
+        if (impl == BLOCKED_WHEEL && node->wheel == NULL) {
+            node->wheel = wheel_new_in(&node->arena);
+        }
+    }
+}
+
+/* Names of the scheduling policies
+ */
+static const char *const policy_names[POLICY_COUNT] = {
+#define POLICY_NAME(id, name, description) name,
+    PROCESS_POLICIES(POLICY_NAME)
+#undef POLICY_NAME
+};
+
+/* Look up a scheduling policy by name
+ * @params:
+ *   name: name of the policy, see PROCESS_POLICIES
+ * @returns:
+ *   the policy, or -1 if there is no policy with that name
+ */
+extern int process_policy(const char *name) {
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        if (!strcmp(name, policy_names[policy])) {
+            return policy;
+        }
+    }
+    return -1;
+}
+
+/* Select the scheduling policy, must be called before any process is admitted
+ * @params:
+ *   sim: simulation
+ *   policy: one of PROCESS_POLICIES
+ * @returns:
+ *   none
+ */
+extern void process_set_policy(sim_t *sim, int policy) {
+    sim->policy = policy;
+}
+
+/* Write out the statistics of the processes while the nodes are simulated, must be called before the nodes
+ * are simulated.  A process' statistics are written once the clocks of all the nodes have passed its finish time,
+ * in the same order as node_stats, and its context is then released.
+ * @params:
+ *   sim: simulation
+ *   fout: FILE into which the statistics should be written
+ *   release: called with arg for each process whose statistics have been written, from any thread, or NULL.
+ *            Processes made by process_create are not passed to it.
+ *   arg: argument of release
+ * @returns:
+ *   none
+ */
+extern void process_set_stream(sim_t *sim, FILE *fout, void (*release)(void *arg, context *proc), void *arg) {
+    sim->stream_out = fout;
+    sim->release = release;
+    sim->release_arg = arg;
+    sim->stream_lists = malloc(sim->num_nodes * sizeof(context **));
+    sim->stream_counts = malloc(sim->num_nodes * sizeof(int));
+    sim->stream_pos = malloc(sim->num_nodes * sizeof(int));
+    assert(sim->stream_lists && sim->stream_counts && sim->stream_pos);
+}
+
+/* Only keep the distributions of the processes' times instead of writing out the trace and the statistics of
+ * each process, must be called before the nodes are simulated.  Finished processes are released at the end
+ * of the tick in which they finish.
+ * @params:
+ *   sim: simulation
+ *   release: called with arg for each finished process not made by process_create, from any thread, or NULL
+ *   arg: argument of release
+ * @returns:
+ *   none
+ */
+extern void process_set_quiet(sim_t *sim, void (*release)(void *arg, context *proc), void *arg) {
+    sim->release = release;
+    sim->release_arg = arg;
+    for (int i = 0; i < sim->num_nodes; i++) {
+        sim->nodes[i].dist = arena_alloc(&sim->nodes[i].arena, sizeof(dist_t));
+    }
+}
+
+/* Hand the state transitions of the processes to a sink instead of writing out the trace, must be called before
+ * the nodes are simulated
+ * @params:
+ *   sim: simulation
+ *   sink: receives each node's transitions in order, in batches, from the thread simulating the node
+ *   arg: argument of sink
+ * @returns:
+ *   none
+ */
+extern void process_set_events(sim_t *sim, trace_sink_t sink, void *arg) {
+    for (int i = 0; i < sim->num_nodes; i++) {
+        trace_set_sink(&sim->nodes[i].trace, sink, arg);
+    }
+}
+
+/* Record the times of a node's finished processes in its distributions and release the processes
+ * @params:
+ *   node: node being simulated, in quiet mode
+ * @returns:
+ *   none
+ */
+static void dist_record(node_data_t *node) {
+    dist_t *dist = node->dist;
+    for (int i = 0; i < node->finished_count; i++) {
+        context *proc = node->finished[i];
+        context_cold *cold = proc->cold;
+        hist_record(&dist->wait, proc->wait_time);
+        hist_record(&dist->block, cold->block_time);
+        hist_record(&dist->turnaround, cold->finish_time - proc->arrival);
+        if (cold->first_run >= 0) {
+            hist_record(&dist->response, cold->first_run - proc->arrival);
+        }
+        node->finish_time = cold->finish_time;
+        if (node->sim->release && !cold->created) {
+            node->sim->release(node->sim->release_arg, proc);
+        }
+    }
+    node->finished_count = 0;
+}
+
+/* Add a process to a node's blocked processes
+ * @params:
+ *   node: node simulating the process
+ *   proc: blocked process, with its wake-up time in duration
+ * @returns:
+ *   none
+ */
+static void blocked_add(node_data_t *node, context *proc) {
+    if (node->sim->blocked_impl == BLOCKED_WHEEL) {
+        wheel_add(node->wheel, proc, proc->duration);
+    } else {
+        prio_q_add(node->blocked, proc, proc->duration);
+    }
+    METRIC_QUEUE_ADD(node, blocked);
+}
+
+/* Take out the next blocked process due to wake up by the node clock, processes waking up at
+ * the same time come out in the order they blocked
+ * @params:
+ *   node: node being simulated
+ * @returns:
+ *   the process, or NULL if none is due
+ */
+static context *blocked_due(node_data_t *node) {
+    context *proc;
+    if (node->sim->blocked_impl == BLOCKED_WHEEL) {
+        proc = wheel_expire(node->wheel, node->node_clock);
+    } else if (prio_q_empty(node->blocked) ||
+               ((context *) prio_q_peek(node->blocked))->duration > node->node_clock) {
+        proc = NULL;
+    } else {
+        proc = prio_q_remove(node->blocked);
+    }
+    if (proc != NULL) {
+        METRIC_QUEUE_REMOVE(node, blocked);
+    }
+    return proc;
+}
+
+/* Find when the next blocked process wakes up
+ * @params:
+ *   node: node being simulated
+ * @returns:
+ *   the wake-up time, or INT_MAX if no process is blocked
+ */
+static int blocked_next(node_data_t *node) {
+    if (node->sim->blocked_impl == BLOCKED_WHEEL) {
+        return wheel_next(node->wheel);
+    }
+    return prio_q_empty(node->blocked) ? INT_MAX : ((context *) prio_q_peek(node->blocked))->duration;
+}
+
+/* Check whether a node has blocked processes
+ * @params:
+ *   node: node to look at
+ * @returns:
+ *   1 if no process is blocked, 0 otherwise
+ */
+static int blocked_empty(node_data_t *node) {
+    if (node->sim->blocked_impl == BLOCKED_WHEEL) {
+        return wheel_empty(node->wheel);
+    }
+    return prio_q_empty(node->blocked);
+}
+
 /* Print state of process
  * @params:
+ *   node: node simulating the process
+ *   proc: process' context
+ * @returns:
+ *   none
+ */
+static void print_process(node_data_t *node, context *proc) {
+    trace_event(&node->trace, proc->node, node->node_clock, proc->id, proc->state,
+                proc->state == PROC_RUNNING ? proc->cpu : 0);
+}
+
+/* Find the CPU a process is queued on or last ran on
+ * @params:
+ *   node: node of the process
+ *   proc: process' context
+ * @returns:
+ *   the process' CPU
+ */
+static cpu_t *cpu_of(node_data_t *node, context *proc) {
+    return &node->cpus[proc->cpu ? proc->cpu - 1 : 0];
+}
+
+/* Move a process to a CPU.  Processes only record their CPU on nodes with more than one.
+ * @params:
+ *   node: node of the process
  *   proc: process' context
+ *   c: index of the CPU
  * @returns:
  *   none
  */
-static void print_process(context *proc) {
-    printf("[%02d] %5.5d: process %d %s\n", proc->node, nodes[proc->node - 1].node_clock, proc->id,
-           states[proc->state]);
+static void set_cpu(node_data_t *node, context *proc, int c) {
+    if (node->num_cpus > 1) {
+        proc->cpu = c + 1;
+    }
 }
 
 /* Compute priority of process, depending on whether SJF or priority based scheduling is used
@@ -91,16 +534,180 @@ static int actual_priority(context *proc) {
     return proc->priority;
 }
 
+/* Priority of a process in its CPU's ready queue under a scheduling policy, as it was added to the queue
+ * @params:
+ *   proc: process' context
+ *   policy: scheduling policy
+ * @returns:
+ *   priority of process, lower runs sooner, processes with the same priority run in the order they were queued
+ */
+POLICY_INLINE int policy_key(context *proc, int policy) {
+    switch (policy) {
+        case POLICY_PRIORITY:
+            return actual_priority(proc);
+        case POLICY_SRTF:
+            return proc->duration;
+        case POLICY_MLFQ:
+        case POLICY_FAIR:
+            return proc->cold->sched;
+        default:
+            return 0;
+    }
+}
+
+/* Enqueue hook: called as a process joins a ready queue, before its state changes to ready.
+ * Under fair share a new or migrated process starts at the node's virtual clock, so that it does not take
+ * over the CPU until it has caught up, and a process waking up is given at most a quantum of credit.
+ * @params:
+ *   node: node simulating the process
+ *   proc: process' context
+ *   policy: scheduling policy
+ * @returns:
+ *   priority of process in the ready queue
+ */
+POLICY_INLINE int policy_enqueue(node_data_t *node, context *proc, int policy) {
+    if (policy == POLICY_FAIR) {
+        context_cold *cold = proc->cold;
+        if (proc->state == PROC_NEW || proc->state == PROC_MIGRATING) {
+            cold->sched = node->vclock;
+        } else if (proc->state == PROC_BLOCKED && cold->sched < node->vclock - node->sim->quantum) {
+            cold->sched = node->vclock - node->sim->quantum;
+        }
+    }
+    return policy_key(proc, policy);
+}
+
+/* Pick-next hook: called as the process at the head of a ready queue starts running
+ * @params:
+ *   node: node simulating the process
+ *   proc: process' context
+ *   policy: scheduling policy
+ * @returns:
+ *   the number of ticks the process may run before going back to the ready queue
+ */
+POLICY_INLINE int policy_pick(node_data_t *node, context *proc, int policy) {
+    int quantum = node->sim->quantum;
+    switch (policy) {
+        case POLICY_FIFO:
+        case POLICY_SRTF:
+            return NO_QUANTUM;
+        case POLICY_MLFQ:
+            return quantum > INT_MAX >> proc->cold->sched ? NO_QUANTUM : quantum << proc->cold->sched;
+        case POLICY_FAIR:
+            if (proc->cold->sched > node->vclock) {
+                node->vclock = proc->cold->sched;
+            }
+            return quantum;
+        default:
+            return quantum;
+    }
+}
+
+/* Should-preempt hook: called as a process becomes ready on a CPU that is running another process
+ * @params:
+ *   node: node simulating the processes
+ *   cpu: CPU the process is queued on
+ *   proc: process' context
+ *   policy: scheduling policy
+ * @returns:
+ *   1 if the running process is to be preempted at this tick, 0 otherwise
+ */
+POLICY_INLINE int policy_preempt(node_data_t *node, cpu_t *cpu, context *proc, int policy) {
+    context *cur = cpu->cur;
+    switch (policy) {
+        case POLICY_PRIORITY:
+            return actual_priority(cur) > actual_priority(proc);
+        case POLICY_SRTF:
+            /* The running process has duration - 1 ticks left after this one
+             */
+            return proc->duration < cur->duration - 1;
+        case POLICY_MLFQ:
+            return proc->cold->sched < cur->cold->sched;
+        case POLICY_FAIR: {
+            /* Once the running process is a quantum ahead, counting the ticks of its current run
+             */
+            int ran = node->sim->quantum - cpu->quantum;
+            return proc->cold->sched + node->sim->quantum < cur->cold->sched + ran;
+        }
+        default:
+            return 0;
+    }
+}
+
+/* Tick hook: called at the tick at which a running process stops running, because its DOOP is done, its
+ * quantum is used up or it is preempted.  The event engine skips the ticks in between, so the policies
+ * account for the ticks the process ran here.
+ * @params:
+ *   node: node simulating the process
+ *   cpu: CPU the process ran on, with the quantum it had left
+ *   proc: process' context
+ *   policy: scheduling policy
+ * @returns:
+ *   none
+ */
+POLICY_INLINE void policy_tick(node_data_t *node, cpu_t *cpu, context *proc, int policy) {
+    if (policy == POLICY_MLFQ && cpu->quantum == 0 && proc->cold->sched < MLFQ_LEVELS - 1) {
+        proc->cold->sched++;
+    } else if (policy == POLICY_FAIR) {
+        proc->cold->sched += node->sim->quantum - cpu->quantum;
+    }
+}
+
+/* Returns true if process a is reported before process b in the statistics
+ * Processes are ordered by finish time, then node, then process id.
+ * @params:
+ *   a, b: finished processes' contexts
+ * @returns:
+ *   1 if a comes first, 0 otherwise
+ */
+static int finished_before(context *a, context *b) {
+    if (a->cold->finish_time != b->cold->finish_time) {
+        return a->cold->finish_time < b->cold->finish_time;
+    }
+    if (a->node != b->node) {
+        return a->node < b->node;
+    }
+    return a->id < b->id;
+}
+
+/* Append a finished process to the node's own finished list.
+ * Only the thread simulating the node touches the list, so no locking is needed.
+ * The node clock never goes back, so only processes finishing in the same tick
+ * may need to be reordered by id.
+ * @params:
+ *   node: node on which the process finished
+ *   proc: process' context
+ * @returns:
+ *   none
+ */
+static void finished_append(node_data_t *node, context *proc) {
+    if (node->finished_count == node->finished_cap) {
+        node->finished_cap = node->finished_cap ? 2 * node->finished_cap : 16;
+        context **bigger = arena_alloc(&node->arena, node->finished_cap * sizeof(context *));
+        if (node->finished_count > 0) {
+            memcpy(bigger, node->finished, node->finished_count * sizeof(context *));
+        }
+        node->finished = bigger;
+    }
+
+    int i = node->finished_count++;
+    for (; i > 0 && finished_before(proc, node->finished[i - 1]); i--) {
+        node->finished[i] = node->finished[i - 1];
+    }
+    node->finished[i] = proc;
+}
+
 /* Use the node to access the correct queue
  * Insert process into appropriate queue based on the primitive it is performing
  * @params:
+ *   node: node simulating the process
  *   proc: process' context
  *   next_op: if true, current primitive is done, so move IP to next primitive.
+ *   policy: scheduling policy
  * @returns:
  *   none
  */
-static void insert_in_queue(context *proc, int next_op) {
-    node_data_t *node = &nodes[proc->node - 1];
+POLICY_INLINE void insert_in_queue(node_data_t *node, context *proc, int next_op, int policy) {
 
     /* If current primitive is done, move to next
      */
@@ -117,8 +724,24 @@ static void insert_in_queue(context *proc, int next_op) {
      * 3. If HALT, process is not queued
      */
     if (op == OP_DOOP) {
+        /* Queue the process on its own CPU, unless that CPU is busy and a sibling has nothing to do
+         */
+        cpu_t *cpu = cpu_of(node, proc);
+        if (cpu->cur != NULL || cpu->queued > 0) {
+            for (int c = 0; c < node->num_cpus; c++) {
+                if (node->cpus[c].cur == NULL && node->cpus[c].queued == 0) {
+                    cpu = &node->cpus[c];
+                    set_cpu(node, proc, c);
+                    break;
+                }
+            }
+        }
+        int key = policy_enqueue(node, proc, policy);
         proc->state = PROC_READY;
-        prio_q_add(node->ready, proc, actual_priority(proc));
+        prio_q_add(cpu->ready, proc, key);
+        cpu->queued++;
+        node->queued++;
+        METRIC_QUEUE_ADD(node, ready);
         proc->wait_count++;
         proc->enqueue_time = node->node_clock;
     } else if (op == OP_BLOCK) {
@@ -126,135 +749,1665 @@ static void insert_in_queue(context *proc, int next_op) {
          */
         proc->state = PROC_BLOCKED;
         proc->duration += node->node_clock;
-        prio_q_add(node->blocked, proc, proc->duration);
+        blocked_add(node, proc);
     } else {
         /* Use the node_clock to store the finish_time of the process.
         */
         proc->state = PROC_FINISHED;
-        proc->finish_time = node->node_clock;
+        proc->cold->finish_time = node->node_clock;
+        finished_append(node, proc);
+    }
+    print_process(node, proc);
+}
 
-        /*
-         * Mutex lock used to prevent race conditions
-         * Threads access the finished queue (shared variable) one at a time
-         */
-        pthread_mutex_lock(&finished_mutex);
-        prio_q_add(finished, proc, proc->finish_time * 10000 + proc->node * 100 + proc->id);
-        pthread_mutex_unlock(&finished_mutex);
+/* Find the CPU of a node with the least work, running or queued
+ * @params:
+ *   node: node to look at
+ * @returns:
+ *   index of the CPU, the lowest one on ties
+ */
+static int least_loaded_cpu(node_data_t *node) {
+    int least = 0;
+    for (int c = 1; c < node->num_cpus; c++) {
+        cpu_t *cpu = &node->cpus[c];
+        if (cpu->queued + (cpu->cur != NULL) < node->cpus[least].queued + (node->cpus[least].cur != NULL)) {
+            least = c;
+        }
     }
-    print_process(proc);
+    return least;
 }
 
-/* Admit a process into the simulation
+/* Add bytes to an FNV-1a hash
+ * @params:
+ *   hash: hash of the bytes so far
+ *   data: bytes to add
+ *   len: number of bytes
+ * @returns:
+ *   hash including the bytes
+ */
+static unsigned int fnv_add(unsigned int hash, const void *data, size_t len) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/* Add a process to the fingerprint of a node's admitted processes, which a snapshot is checked against
+ * when it is restored, so that it is only restored with the workload it was taken of
  * @params:
+ *   fingerprint: fingerprint of the processes admitted before
+ *   proc: process being admitted
+ * @returns:
+ *   fingerprint including the process
+ */
+static unsigned int fingerprint_add(unsigned int fingerprint, const context *proc) {
+    int fields[] = {(int) proc->cold->prog->hash, proc->priority, proc->node, proc->arrival};
+    return fnv_add(fingerprint, fields, sizeof(fields));
+}
+
+/* Admit a process into its node at the node's current time
+ * @params:
+ *   node: node on which the process is to be simulated
  *   proc: pointer to the program context of the process to be admitted
+ *   policy: scheduling policy
  * @returns:
- *   returns 1
+ *   none
  */
-extern int process_admit(context *proc) {
-    /* Use the proc->node to use assigned node parameters.
-     * Use a static variable to assign each process a unique process id.
+POLICY_INLINE void admit(node_data_t *node, context *proc, int policy) {
+    /* Each node assigns its process ids in order of admission.
      */
-    node_data_t *node = &nodes[proc->node - 1];
     proc->id = node->next_proc_id++;
+    if (node->sim->checkpoint_interval > 0) {
+        node->fingerprint = fingerprint_add(node->fingerprint, proc);
+    }
     proc->state = PROC_NEW;
-    print_process(proc);
-    insert_in_queue(proc, 1);
-    return 1;
+    proc->cold->host = node->node_id;
+
+    /* Start the process out on the CPU with the least work
+     */
+    set_cpu(node, proc, least_loaded_cpu(node));
+    print_process(node, proc);
+    insert_in_queue(node, proc, 1, policy);
 }
 
-/* Perform the simulation
+/* Admit a process into the simulation
  * @params:
- *   none
+ *   sim: simulation
+ *   proc: pointer to the program context of the process to be admitted
  * @returns:
- *   returns NULL
+ *   returns 1
  */
-void *node_simulate(void *arg) {
+extern int process_admit(sim_t *sim, context *proc) {
+    /* Use the proc->node to use assigned node parameters.
+     */
+    node_data_t *node = &sim->nodes[proc->node - 1];
+    trace_start(&node->trace, &node->arena);
+    admit(node, proc, sim->policy);
+    return 1;
+}
+
+/* Create a process running a program given as an array of primitives, for process_submit.  The context lives
+ * until the simulation is freed, and is never handed to the release callback of process_set_stream or
+ * process_set_quiet.  Its place in the workload counts the processes made by process_create, so they should not be
+ * mixed with loaded ones in a checkpointed simulation.  Must be called from the thread routing the processes.
+ * @params:
+ *   sim: simulation
+ *   name: program name, at most 10 characters are kept
+ *   ops: the program's primitives, ending with OP_HALT
+ *   size: number of primitives
+ *   priority: process priority
+ *   node: node on which the process is to be simulated
+ *   arrival: time at which the process arrives on its node
+ * @returns:
+ *   the new process, or NULL if the program is malformed
+ */
+extern context *process_create(sim_t *sim, const char *name, const opcode *ops, int size, int priority, int node,
+                               int arrival) {
+    program *prog = program_intern(ops, size, name);
+    if (!prog) {
+        return NULL;
+    }
+    context *proc = context_create(&sim->submit_arena, name, prog, priority, node);
+    proc->arrival = arrival;
+    proc->cold->index = sim->created++;
+    proc->cold->created = 1;
+    return proc;
+}
+
+/* Route a process to its node, which admits it once its clock reaches the arrival time
+ * @params:
+ *   sim: simulation
+ *   proc: pointer to the program context of the process
+ * @returns:
+ *   1 on success, 0 if the process cannot be routed
+ */
+extern int process_submit(sim_t *sim, context *proc) {
+    if (proc->node < 1 || proc->node > sim->num_nodes) {
+        fprintf(stderr, "Bad input: %s is assigned to node %d, expecting 1 to %d\n", proc->cold->name, proc->node,
+                sim->num_nodes);
+        return 0;
+    }
+
+    /* A node can only move its clock past a time once it has seen a later arrival,
+     * so arrivals must not go back in time on any node.
+     */
+    node_data_t *node = &sim->nodes[proc->node - 1];
+    if (proc->arrival < node->last_arrival) {
+        fprintf(stderr, "Bad input: %s arrives at %d, before the previous process on node %d\n", proc->cold->name,
+                proc->arrival, proc->node);
+        return 0;
+    }
+    node->last_arrival = proc->arrival;
+
+    inbox_push(&node->inbox, arena_alloc(&sim->submit_arena, sizeof(inbox_cell_t)), proc);
+    return 1;
+}
+
+/* Tell the nodes that no more processes will be routed to them
+ * @params:
+ *   sim: simulation
+ * @returns:
+ *   none
+ */
+extern void process_submit_done(sim_t *sim) {
+    for (int i = 0; i < sim->num_nodes; i++) {
+        inbox_close(&sim->nodes[i].inbox);
+    }
+}
+
+/* Compute how many ticks the node clock can advance before something interesting happens:
+ * a process arrives or migrates in, a blocked process wakes up, a running process completes
+ * its DOOP or uses up its quantum, or the balancing window ends.
+ * @params:
+ *   node: node being simulated
+ * @returns:
+ *   number of ticks to advance, at least 1
+ */
+static int next_event(node_data_t *node) {
+    int delta = INT_MAX;
+
+    for (int c = 0; c < node->num_cpus; c++) {
+        cpu_t *cpu = &node->cpus[c];
+        if (cpu->cur != NULL) {
+            int left = cpu->cur->duration < cpu->quantum ? cpu->cur->duration : cpu->quantum;
+            if (left < delta) {
+                delta = left;
+            }
+        }
+    }
+
+    int wake = blocked_next(node);
+    if (wake != INT_MAX && wake - node->node_clock < delta) {
+        delta = wake - node->node_clock;
+    }
+
+    if (!prio_q_empty(node->transit)) {
+        context *proc = prio_q_peek(node->transit);
+        if (proc->enqueue_time - node->node_clock < delta) {
+            delta = proc->enqueue_time - node->node_clock;
+        }
+    }
+    if (node->sim->window > 0 && node->window_end - node->node_clock < delta) {
+        delta = node->window_end - node->node_clock;
+    }
+
+    /* If the next process has not been routed here yet, it may arrive at the next tick, or at the horizon
+     */
+    context *next = inbox_peek(&node->inbox, 0);
+    if (next != NULL) {
+        if (next->arrival - node->node_clock < delta) {
+            delta = next->arrival - node->node_clock;
+        }
+    } else if (!inbox_done(&node->inbox) && node->horizon - node->node_clock < delta) {
+        delta = node->horizon - node->node_clock;
+    }
+
+    /* Nothing can happen sooner than the next tick, and if nothing is left to happen the
+     * simulation is over
+     */
+    return delta < 1 || delta == INT_MAX ? 1 : delta;
+}
+
+/* Preempt the process running on the CPU a process was just queued on, if the new process has higher priority
+ * @params:
+ *   node: node being simulated
+ *   proc: process that has been admitted or unblocked
+ *   policy: scheduling policy
+ * @returns:
+ *   none
+ */
+POLICY_INLINE void check_preempt(node_data_t *node, context *proc, int policy) {
+    cpu_t *cpu = cpu_of(node, proc);
+    cpu->preempt |= cpu->cur != NULL && proc->state == PROC_READY && policy_preempt(node, cpu, proc, policy);
+}
+
+/* Find the sibling CPU with the most processes waiting, for an idle CPU to take work from
+ * @params:
+ *   node: node being simulated, with at least one process queued
+ * @returns:
+ *   the CPU with the longest ready queue, the lowest numbered one on ties
+ */
+static cpu_t *busiest_cpu(node_data_t *node) {
+    cpu_t *busiest = &node->cpus[0];
+    for (int c = 1; c < node->num_cpus; c++) {
+        if (node->cpus[c].queued > busiest->queued) {
+            busiest = &node->cpus[c];
+        }
+    }
+    return busiest;
+}
+
+/* Start running the process at the head of a ready queue on an idle CPU
+ * Be sure to keep track of how long it waited in the ready queue
+ * @params:
+ *   node: node being simulated
+ *   c: index of the idle CPU
+ *   from: CPU whose ready queue to take the process from, which has at least one process queued
+ *   policy: scheduling policy
+ * @returns:
+ *   none
+ */
+POLICY_INLINE void run_next(node_data_t *node, int c, cpu_t *from, int policy) {
+    cpu_t *cpu = &node->cpus[c];
+    context *cur = prio_q_remove(from->ready);
+    METRIC_QUEUE_REMOVE(node, ready);
+    from->queued--;
+    node->queued--;
+
+    set_cpu(node, cur, c);
+    cur->wait_time += node->node_clock - cur->enqueue_time;
+    if (cur->cold->first_run < 0) {
+        cur->cold->first_run = node->node_clock;
+    }
+    cpu->quantum = policy_pick(node, cur, policy);
+    cpu->cur = cur;
+    node->running++;
+    cur->state = PROC_RUNNING;
+    print_process(node, cur);
+}
+
+/* Check whether a node has anything left to simulate
+ * @params:
+ *   node: node to look at
+ * @returns:
+ *   1 if processes are ready, running, blocked, migrating in or still to arrive, 0 otherwise
+ */
+static int node_active(node_data_t *node) {
+    return node->queued > 0 || node->running > 0 || node->incoming > 0 || !blocked_empty(node) ||
+           !inbox_done(&node->inbox);
+}
+
+/* Move the process at the head of a node's busiest ready queue to another node, which gets it
+ * the simulation's migrate_cost ticks later.  Only called while every node waits at the window barrier.
+ * @params:
+ *   from: overloaded node
+ *   to: node with an idle CPU
+ * @returns:
+ *   none
+ */
+static void migrate(node_data_t *from, node_data_t *to) {
+    cpu_t *cpu = busiest_cpu(from);
+    context *proc = prio_q_remove(cpu->ready);
+    METRIC_QUEUE_REMOVE(from, ready);
+    METRIC_ADD(from, migrations, 1);
+    cpu->queued--;
+    from->queued--;
+
+    proc->wait_time += from->node_clock - proc->enqueue_time;
+    proc->state = PROC_MIGRATING;
+    print_process(from, proc);
+
+    /* The enqueue time holds the time at which the process gets to its new node
+     */
+    proc->cold->host = to->node_id;
+    proc->cpu = 0;
+    set_cpu(to, proc, least_loaded_cpu(to));
+    proc->cold->migrations++;
+    proc->enqueue_time = to->node_clock + to->sim->migrate_cost;
+    prio_q_add(to->transit, proc, proc->enqueue_time);
+    to->incoming++;
+}
+
+/* Balance the load across the nodes, called by one node thread while the others wait at the barrier.
+ * Processes that will not get a CPU at the next tick are moved, one at a time, from the node with the
+ * most of them to the node with the most CPUs that would otherwise be idle.
+ * @params:
+ *   sim: simulation
+ * @returns:
+ *   none
+ */
+static void balance(sim_t *sim) {
+    for (;;) {
+        node_data_t *from = NULL, *to = NULL;
+        int most_waiting = 0, most_idle = 0;
+
+        for (int i = 0; i < sim->num_nodes; i++) {
+            node_data_t *node = &sim->nodes[i];
+            int free_cpus = node->num_cpus - node->running - node->queued - node->incoming;
+            if (-free_cpus > most_waiting && node->queued > 0) {
+                most_waiting = -free_cpus;
+                from = node;
+            } else if (free_cpus > most_idle) {
+                most_idle = free_cpus;
+                to = node;
+            }
+        }
+        if (from == NULL || to == NULL) {
+            return;
+        }
+        migrate(from, to);
+    }
+}
+
+/* Restore the heap property of the merge heap, moving entry i down
+ * @params:
+ *   lists: each node's finished processes, in finishing order
+ *   heap: array of node indices, ordered by the process at the head of each node's list
+ *   pos: position of the head of each node's list
+ *   n: number of entries in heap
+ *   i: entry to move down
+ * @returns:
+ *   none
+ */
+static void merge_sift_down(context ***lists, int *heap, int *pos, int n, int i) {
+    for (;;) {
+        int best = i;
+        for (int c = 2 * i + 1; c <= 2 * i + 2 && c < n; c++) {
+            if (finished_before(lists[heap[c]][pos[heap[c]]], lists[heap[best]][pos[heap[best]]])) {
+                best = c;
+            }
+        }
+        if (best == i) {
+            return;
+        }
+        int tmp = heap[i];
+        heap[i] = heap[best];
+        heap[best] = tmp;
+        i = best;
+    }
+}
+
+/* Merges the nodes' lists of finished processes and calls context_stats for each process that
+ * finished before a limit, in finishing order
+ * @params:
+ *   lists: each node's finished processes, in finishing order
+ *   counts: number of processes in each list
+ *   pos: position of the first process of each list to report, advanced past the processes reported
+ *   num_nodes: number of lists
+ *   limit: clock before which the processes reported finished
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+static void merge_stats(context ***lists, int *counts, int *pos, int num_nodes, int limit, FILE *fout) {
+    /* k-way merge of the lists, using a heap of the nodes that still have processes to report
+     */
+    int *heap = malloc(num_nodes * sizeof(int));
+    assert(heap);
+
+    int n = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        if (pos[i] < counts[i] && lists[i][pos[i]]->cold->finish_time < limit) {
+            heap[n++] = i;
+        }
+    }
+    for (int i = n / 2 - 1; i >= 0; i--) {
+        merge_sift_down(lists, heap, pos, n, i);
+    }
+
+    while (n > 0) {
+        int i = heap[0];
+        context_stats(lists[i][pos[i]++], fout);
+        if (pos[i] == counts[i] || lists[i][pos[i]]->cold->finish_time >= limit) {
+            heap[0] = heap[--n];
+        }
+        merge_sift_down(lists, heap, pos, n, 0);
+    }
+    free(heap);
+}
+
+/* Merges the per-node finished lists and calls Context_stats for each process in finishing order.
+ * When streaming, the statistics have already been written and only the trace is left to write out.
+ * @params:
+ *   sim: simulation, after all its nodes have been simulated
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void node_stats(sim_t *sim, FILE *fout) {
+    node_data_t *nodes = sim->nodes;
+    int num_nodes = sim->num_nodes;
+
+    /* Write out any trace output that is still held back, in node order
+     */
+    for (int i = 0; i < num_nodes; i++) {
+        trace_flush(&nodes[i].trace);
+    }
+
+    context ***lists = malloc(num_nodes * sizeof(context **));
+    int *counts = malloc(num_nodes * sizeof(int));
+    int *pos = calloc(num_nodes, sizeof(int));
+    assert(lists && counts && pos);
+    for (int i = 0; i < num_nodes; i++) {
+        lists[i] = nodes[i].finished;
+        counts[i] = nodes[i].finished_count;
+    }
+    merge_stats(lists, counts, pos, num_nodes, INT_MAX, fout);
+
+    free(lists);
+    free(counts);
+    free(pos);
+}
+
+/* Hand a node's finished processes over to the statistics, when streaming
+ * @params:
+ *   node: node being simulated
+ *   clock: the node will not finish any more processes before this clock
+ * @returns:
+ *   none
+ */
+static void stream_handoff(node_data_t *node, int clock) {
+    stream_t *st = &node->stream;
+    if (node->finished_count > 0) {
+        pthread_mutex_lock(&st->lock);
+        if (st->handoff_count + node->finished_count > st->handoff_cap) {
+            st->handoff_cap = 2 * (st->handoff_count + node->finished_count);
+            st->handoff = realloc(st->handoff, st->handoff_cap * sizeof(context *));
+            assert(st->handoff);
+        }
+        memcpy(st->handoff + st->handoff_count, node->finished, node->finished_count * sizeof(context *));
+        st->handoff_count += node->finished_count;
+        pthread_mutex_unlock(&st->lock);
+        node->finished_count = 0;
+    }
+    atomic_store_explicit(&st->clock, clock, memory_order_release);
+}
+
+/* Write out the statistics of the processes that finished before the watermark, and release them.
+ * The caller holds the simulation's stream_lock.
+ * @params:
+ *   sim: simulation
+ *   watermark: clock that every node has passed, read before calling
+ * @returns:
+ *   none
+ */
+static void stream_emit(sim_t *sim, int watermark) {
+    /* Pick up what the nodes have handed over, which is everything finishing before the watermark
+     */
+    for (int i = 0; i < sim->num_nodes; i++) {
+        stream_t *st = &sim->nodes[i].stream;
+        pthread_mutex_lock(&st->lock);
+        if (st->handoff_count > 0) {
+            if (st->pending_count + st->handoff_count > st->pending_cap) {
+                st->pending_cap = 2 * (st->pending_count + st->handoff_count);
+                st->pending = realloc(st->pending, st->pending_cap * sizeof(context *));
+                assert(st->pending);
+            }
+            memcpy(st->pending + st->pending_count, st->handoff, st->handoff_count * sizeof(context *));
+            st->pending_count += st->handoff_count;
+            st->handoff_count = 0;
+        }
+        pthread_mutex_unlock(&st->lock);
+        sim->stream_lists[i] = st->pending;
+        sim->stream_counts[i] = st->pending_count;
+        sim->stream_pos[i] = 0;
+    }
+
+    char *text;
+    size_t len;
+    FILE *out = open_memstream(&text, &len);
+    assert(out);
+    merge_stats(sim->stream_lists, sim->stream_counts, sim->stream_pos, sim->num_nodes, watermark, out);
+    fclose(out);
+    if (len > 0) {
+        trace_write_text(sim->stream_out, text, len);
+    }
+    free(text);
+
+    for (int i = 0; i < sim->num_nodes; i++) {
+        stream_t *st = &sim->nodes[i].stream;
+        int done = sim->stream_pos[i];
+        for (int j = 0; j < done && sim->release; j++) {
+            if (!st->pending[j]->cold->created) {
+                sim->release(sim->release_arg, st->pending[j]);
+            }
+        }
+        if (done > 0) {
+            memmove(st->pending, st->pending + done, (st->pending_count - done) * sizeof(context *));
+            st->pending_count -= done;
+        }
+    }
+}
+
+/* Write out the statistics of the processes that every node's clock has passed the finish time of,
+ * while the nodes are being simulated, see process_set_stream
+ * @params:
+ *   sim: simulation
+ *   wait: 0 to write out what can be written now, 1 to keep going until every node is done
+ * @returns:
+ *   none
+ */
+extern void process_stream(sim_t *sim, int wait) {
+    for (;;) {
+        int watermark = INT_MAX;
+        for (int i = 0; i < sim->num_nodes; i++) {
+            int clock = atomic_load_explicit(&sim->nodes[i].stream.clock, memory_order_acquire);
+            watermark = clock < watermark ? clock : watermark;
+        }
+
+        pthread_mutex_lock(&sim->stream_lock);
+        stream_emit(sim, watermark);
+        pthread_mutex_unlock(&sim->stream_lock);
+
+        if (!wait || watermark == INT_MAX) {
+            return;
+        }
+        usleep(STREAM_POLL_US);
+    }
+}
+
+/* A snapshot file being written or read.  A snapshot is the magic string followed by zigzag LEB128 varints:
+ * the format version, the settings it was taken with and the clock at which all the nodes stopped, then
+ * for each node its CPUs, the fingerprint of the processes admitted to it, the processes running on its CPUs
+ * and queued in their ready queues, and its blocked, in transit and finished processes, leaving out those whose
+ * statistics have been streamed.  Queued processes are in the order they leave their queue, and each process
+ * has its position in the workload and everything that changes as it is simulated.  The snapshot ends with
+ * the FNV-1a hash of everything before it, as 4 little endian bytes.
+ */
+typedef struct snapshot {
+    FILE *f;                    /* when writing, the snapshot file */
+    unsigned int sum;           /* when writing, hash of the bytes written so far */
+    const unsigned char *p;     /* when reading, next byte to read */
+    const unsigned char *end;   /* when reading, end of the bytes before the hash */
+    int ok;                     /* 0 once anything goes wrong */
+    context **procs;            /* when reading, the workload's processes */
+    int num_procs;
+    char *restored;             /* when reading, which processes have been read */
+} snapshot_t;
+
+#define SNAPSHOT_MAGIC "PROSIMCK"
+#define SNAPSHOT_VERSION 4
+
+/* Pointers to the fields of a context that change as it is simulated, besides its ip and stack
+ */
+#define SNAPSHOT_FIELDS(p) {&(p)->duration, &(p)->state, &(p)->id, &(p)->cold->host, &(p)->cold->migrations, \
+                            &(p)->cpu, &(p)->enqueue_time, &(p)->cold->finish_time, &(p)->cold->doop_count, \
+                            &(p)->cold->doop_time, &(p)->cold->block_count, &(p)->cold->block_time, \
+                            &(p)->wait_count, &(p)->wait_time, &(p)->cold->first_run, &(p)->cold->sched}
+
+/* Write bytes to a snapshot, adding them to its hash
+ * @params:
+ *   s: snapshot being written
+ *   data: bytes to write
+ *   len: number of bytes
+ * @returns:
+ *   none
+ */
+static void snap_write(snapshot_t *s, const void *data, size_t len) {
+    fwrite(data, 1, len, s->f);
+    s->sum = fnv_add(s->sum, data, len);
+}
+
+/* Write an int to a snapshot
+ * @params:
+ *   s: snapshot being written
+ *   value: int to write
+ * @returns:
+ *   none
+ */
+static void snap_put(snapshot_t *s, int value) {
+    unsigned char bytes[5];
+    int len = 0;
+    unsigned int v = (unsigned int) value << 1 ^ (unsigned int) (value >> 31);
+    while (v >= 0x80) {
+        bytes[len++] = (unsigned char) ((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    bytes[len++] = (unsigned char) v;
+    snap_write(s, bytes, len);
+}
+
+/* Read an int from a snapshot
+ * @params:
+ *   s: snapshot being read
+ * @returns:
+ *   the int, or 0 if the snapshot ends or is corrupt, in which case s->ok is cleared
+ */
+static int snap_get(snapshot_t *s) {
+    unsigned int v = 0;
+    for (int shift = 0; shift < 35 && s->p < s->end; shift += 7) {
+        unsigned char b = *s->p++;
+        v |= (unsigned int) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return (int) (v >> 1) ^ -(int) (v & 1);
+        }
+    }
+    s->ok = 0;
+    return 0;
+}
+
+/* Priority of a process in each of the queues, as it was added to the queue
+ */
+static int blocked_key(context *proc) {
+    return proc->duration;
+}
+
+static int transit_key(context *proc) {
+    return proc->enqueue_time;
+}
+
+#define POLICY_KEY(id, name, description) \
+    static int ready_key_##id(context *proc) { \
+        return policy_key(proc, id); \
+    }
+PROCESS_POLICIES(POLICY_KEY)
+#undef POLICY_KEY
+
+static int (*const ready_keys[POLICY_COUNT])(context *proc) = {
+#define POLICY_KEY_ENTRY(id, name, description) ready_key_##id,
+    PROCESS_POLICIES(POLICY_KEY_ENTRY)
+#undef POLICY_KEY_ENTRY
+};
+
+/* Write a process to a snapshot
+ * @params:
+ *   s: snapshot being written
+ *   proc: process' context
+ * @returns:
+ *   none
+ */
+static void save_context(snapshot_t *s, context *proc) {
+    int *base = CONTEXT_STACK(proc);
+    int *fields[] = SNAPSHOT_FIELDS(proc);
+
+    snap_put(s, proc->cold->index);
+    snap_put(s, proc->ip);
+    snap_put(s, (int) (proc->cold->stack - base));
+    for (int *p = base; p < proc->cold->stack; p++) {
+        snap_put(s, *p);
+    }
+    for (int i = 0; i < (int) (sizeof(fields) / sizeof(fields[0])); i++) {
+        snap_put(s, *fields[i]);
+    }
+}
+
+/* Check that a process' loop stack is the one it has at its ip: an entry for each LOOP around the ip,
+ * innermost on top, with from 1 to the LOOP's count iterations left
+ * @params:
+ *   proc: process' context, with an ip within its program
+ * @returns:
+ *   1 if the stack matches the ip, 0 otherwise
+ */
+static int stack_matches(const context *proc) {
+    const bytecode *code = proc->code;
+    const int *stack = CONTEXT_STACK(proc);
+    int open = 0;
+    for (int i = 0; i < proc->ip; i++) {
+        open += (BC_OP(code[i]) == OP_LOOP) - (BC_OP(code[i]) == OP_END);
+    }
+    if (open != proc->cold->stack - stack) {
+        return 0;
+    }
+
+    /* Going back from the ip, a LOOP whose END has not been passed is around the ip
+     */
+    int closed = 0;
+    for (int i = proc->ip - 1; i >= 0 && open > 0; i--) {
+        if (BC_OP(code[i]) == OP_END) {
+            closed++;
+        } else if (BC_OP(code[i]) == OP_LOOP && closed > 0) {
+            closed--;
+        } else if (BC_OP(code[i]) == OP_LOOP) {
+            open--;
+            if (stack[open] < 1 || stack[open] > BC_ARG(code[i])) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* Earliest time at which a process blocked on a node can be due: one that blocked for 0 ticks at the node's last
+ * tick wakes up at the next, so it is due a tick before the node's clock
+ */
+#define BLOCKED_FROM(node) ((node)->node_clock > 0 ? (node)->node_clock - 1 : 0)
+
+/* Primitive a process is at in each state it can be saved in, -1 for the states it cannot be saved in
+ */
+static const int STATE_OPS[PROC_STATES] = {
+        [PROC_NEW] = -1, [PROC_READY] = OP_DOOP, [PROC_RUNNING] = OP_DOOP, [PROC_BLOCKED] = OP_BLOCK,
+        [PROC_FINISHED] = OP_HALT, [PROC_MIGRATING] = OP_DOOP
+};
+
+/* Read a process from a snapshot into the workload's context for it, checking that the process can be
+ * where the snapshot puts it
+ * @params:
+ *   s: snapshot being read
+ *   node: node the process is on, with its clock set
+ *   state: state of the processes where the snapshot puts it
+ *   cpu: CPU the process is running or queued on, NULL if it is not on one
+ * @returns:
+ *   the process' context, or NULL if the snapshot is corrupt or does not match the workload
+ */
+static context *load_context(snapshot_t *s, node_data_t *node, int state, cpu_t *cpu) {
+    int index = snap_get(s);
+    if (!s->ok || index < 0 || index >= s->num_procs || s->restored[index]) {
+        s->ok = 0;
+        return NULL;
+    }
+    context *proc = s->procs[index];
+    s->restored[index] = 1;
+
+    int *base = CONTEXT_STACK(proc);
+    int *fields[] = SNAPSHOT_FIELDS(proc);
+    proc->ip = snap_get(s);
+    int depth = snap_get(s);
+    if (depth < 0 || depth > proc->cold->depth) {
+        s->ok = 0;
+        return NULL;
+    }
+    for (int i = 0; i < depth; i++) {
+        base[i] = snap_get(s);
+    }
+    proc->cold->stack = base + depth;
+    for (int i = 0; i < (int) (sizeof(fields) / sizeof(fields[0])); i++) {
+        *fields[i] = snap_get(s);
+    }
+
+    if (!s->ok || proc->state != state || proc->ip < 0 || proc->ip >= proc->cold->prog->size ||
+        BC_OP(proc->code[proc->ip]) != STATE_OPS[state] || !stack_matches(proc)) {
+        s->ok = 0;
+        return NULL;
+    }
+
+    /* A blocked process' duration is the time it wakes up at, the others have at most their primitive's
+     * ticks left, and at least one unless they finished
+     */
+    int ticks = BC_ARG(proc->code[proc->ip]);
+    int from = state == PROC_BLOCKED ? BLOCKED_FROM(node) : state != PROC_FINISHED;
+    int to = state == PROC_BLOCKED ? node->node_clock + ticks : ticks;
+    if (proc->duration < from || proc->duration > to || proc->cpu < 0 || proc->cpu > node->num_cpus ||
+        (cpu && cpu_of(node, proc) != cpu) || proc->cold->host != node->node_id || proc->cold->migrations < 0 ||
+        (state == PROC_MIGRATING && (proc->enqueue_time < node->node_clock ||
+                                     proc->enqueue_time > node->node_clock + node->sim->migrate_cost)) ||
+        (node->sim->policy == POLICY_MLFQ && (proc->cold->sched < 0 || proc->cold->sched >= MLFQ_LEVELS))) {
+        s->ok = 0;
+        return NULL;
+    }
+    proc->op = proc->code[proc->ip];
+    return proc;
+}
+
+/* Write the processes in a queue to a snapshot, in the order they will leave it.
+ * The queue is emptied and refilled in the same order, which keeps the order of processes with the same priority.
+ * @params:
+ *   s: snapshot being written
+ *   queue: queue of processes
+ *   key: priority of a process in the queue
+ * @returns:
+ *   none
+ */
+static void save_queue(snapshot_t *s, prio_q_t *queue, int (*key)(context *)) {
+    context **procs = NULL;
+    int count = 0, cap = 0;
+
+    while (!prio_q_empty(queue)) {
+        if (count == cap) {
+            cap = cap ? 2 * cap : 16;
+            procs = realloc(procs, cap * sizeof(context *));
+            assert(procs);
+        }
+        procs[count++] = prio_q_remove(queue);
+    }
+
+    snap_put(s, count);
+    for (int i = 0; i < count; i++) {
+        save_context(s, procs[i]);
+        prio_q_add(queue, procs[i], key(procs[i]));
+    }
+    free(procs);
+}
+
+/* Read the processes of a queue from a snapshot, adding them to the queue in order
+ * @params:
+ *   s: snapshot being read
+ *   node: node the queue belongs to
+ *   queue: empty queue
+ *   key: priority of a process in the queue
+ *   state: state of the processes in the queue
+ *   cpu: CPU whose ready queue it is, NULL for the node's other queues
+ * @returns:
+ *   number of processes read
+ */
+static int load_queue(snapshot_t *s, node_data_t *node, prio_q_t *queue, int (*key)(context *), int state,
+                      cpu_t *cpu) {
+    int count = snap_get(s);
+    for (int i = 0; i < count && s->ok; i++) {
+        context *proc = load_context(s, node, state, cpu);
+        if (proc) {
+            prio_q_add(queue, proc, key(proc));
+        }
+    }
+    return count;
+}
+
+/* Write a node's blocked processes to a snapshot, in the order they will wake up.
+ * A wheel is emptied and refilled from the earliest time they can be due, which keeps their order.
+ * @params:
+ *   s: snapshot being written
+ *   node: node, stopped at the start of a tick
+ * @returns:
+ *   none
+ */
+static void save_blocked(snapshot_t *s, node_data_t *node) {
+    if (node->sim->blocked_impl != BLOCKED_WHEEL) {
+        save_queue(s, node->blocked, blocked_key);
+        return;
+    }
 
-    /*
-     * Threads are created for each node to simulate in increasing order of node_id
-     * All the process simulated in each node and node_id is used to keep tracks of queues
-     * Context switching will only affect the order of output,
-     * but will not make any difference in process simulation
+    context **procs = NULL;
+    int count = 0, cap = 0;
+    context *proc;
+    while ((proc = wheel_expire(node->wheel, INT_MAX)) != NULL) {
+        if (count == cap) {
+            cap = cap ? 2 * cap : 16;
+            procs = realloc(procs, cap * sizeof(context *));
+            assert(procs);
+        }
+        procs[count++] = proc;
+    }
+
+    wheel_rewind(node->wheel, BLOCKED_FROM(node));
+    snap_put(s, count);
+    for (int i = 0; i < count; i++) {
+        save_context(s, procs[i]);
+        wheel_add(node->wheel, procs[i], blocked_key(procs[i]));
+    }
+    free(procs);
+}
+
+/* Read a node's blocked processes from a snapshot
+ * @params:
+ *   s: snapshot being read
+ *   node: node, with its clock set and no blocked processes
+ * @returns:
+ *   none
+ */
+static void load_blocked(snapshot_t *s, node_data_t *node) {
+    if (node->sim->blocked_impl != BLOCKED_WHEEL) {
+        load_queue(s, node, node->blocked, blocked_key, PROC_BLOCKED, NULL);
+        return;
+    }
+
+    wheel_rewind(node->wheel, BLOCKED_FROM(node));
+    int count = snap_get(s);
+    for (int i = 0; i < count && s->ok; i++) {
+        context *proc = load_context(s, node, PROC_BLOCKED, NULL);
+        if (proc) {
+            wheel_add(node->wheel, proc, blocked_key(proc));
+        }
+    }
+}
+
+/* Write a snapshot of the simulation, called by one node thread while the others wait at the barrier.
+ * The trace output up to the snapshot is written out first, so that a run resumed from the snapshot
+ * picks up the output where it was.  The snapshot goes to a temporary file, which then replaces the previous one.
+ * @params:
+ *   sim: simulation, with every node at the start of the same tick
+ *   clock: the nodes' clock
+ * @returns:
+ *   none
+ */
+static void checkpoint(sim_t *sim, int clock) {
+    char *tmp = malloc(strlen(sim->checkpoint_path) + 5);
+    assert(tmp);
+    sprintf(tmp, "%s.tmp", sim->checkpoint_path);
+
+    for (int i = 0; i < sim->num_nodes; i++) {
+        trace_finish(&sim->nodes[i].trace);
+    }
+    if (sim->stream_out) {
+        pthread_mutex_lock(&sim->stream_lock);
+        stream_emit(sim, clock);
+        pthread_mutex_unlock(&sim->stream_lock);
+    }
+
+    snapshot_t s = {.f = fopen(tmp, "wb"), .sum = FNV_BASIS, .ok = 1};
+    if (!s.f) {
+        perror(tmp);
+        free(tmp);
+        return;
+    }
+    snap_write(&s, SNAPSHOT_MAGIC, 8);
+    snap_put(&s, SNAPSHOT_VERSION);
+    snap_put(&s, sim->num_nodes);
+    snap_put(&s, sim->quantum);
+    snap_put(&s, sim->balance_interval);
+    snap_put(&s, sim->migrate_cost);
+    snap_put(&s, sim->policy);
+    snap_put(&s, clock);
+
+    for (int i = 0; i < sim->num_nodes; i++) {
+        node_data_t *node = &sim->nodes[i];
+        snap_put(&s, node->num_cpus);
+        snap_put(&s, (int) node->fingerprint);
+        snap_put(&s, node->next_proc_id);
+        snap_put(&s, node->vclock);
+        for (int c = 0; c < node->num_cpus; c++) {
+            cpu_t *cpu = &node->cpus[c];
+            snap_put(&s, cpu->cur != NULL);
+            if (cpu->cur != NULL) {
+                save_context(&s, cpu->cur);
+            }
+            snap_put(&s, cpu->quantum);
+            snap_put(&s, cpu->preempt);
+            save_queue(&s, cpu->ready, ready_keys[sim->policy]);
+        }
+        save_blocked(&s, node);
+        save_queue(&s, node->transit, transit_key);
+        snap_put(&s, node->finished_count);
+        for (int j = 0; j < node->finished_count; j++) {
+            save_context(&s, node->finished[j]);
+        }
+    }
+
+    unsigned char sum[4] = {s.sum & 0xff, s.sum >> 8 & 0xff, s.sum >> 16 & 0xff, s.sum >> 24};
+    fwrite(sum, 1, 4, s.f);
+
+    /* Make sure the snapshot is on disk before it replaces the previous one
      */
-    int node_id = *(int *) arg;
-    node_data_t *node = &nodes[node_id - 1];
-    context *cur = NULL;
-    int cpu_quantum;
+    if (fflush(s.f) || fsync(fileno(s.f)) || fclose(s.f) || rename(tmp, sim->checkpoint_path)) {
+        perror(sim->checkpoint_path);
+    }
+    free(tmp);
+}
 
-    /* We can only stop when all processes are in the finished state
-     * no processes are readdy, running, or blocked
+/* Read the whole of a snapshot into memory
+ * @params:
+ *   fin: snapshot
+ *   len: where to store the number of bytes read
+ * @returns:
+ *   the bytes of the snapshot, to be freed by the caller
+ */
+static unsigned char *snap_read_all(FILE *fin, size_t *len) {
+    size_t cap = 4096, n = 0, got;
+    unsigned char *bytes = malloc(cap);
+    assert(bytes);
+    while ((got = fread(bytes + n, 1, cap - n, fin)) > 0) {
+        n += got;
+        if (n == cap) {
+            cap *= 2;
+            bytes = realloc(bytes, cap);
+            assert(bytes);
+        }
+    }
+    *len = n;
+    return bytes;
+}
+
+/* Restore a simulation from a snapshot.  The snapshot's processes are put back on their nodes,
+ * the workload's other processes have yet to arrive and must then be routed with process_submit, except for
+ * those that arrived before the snapshot, whose statistics were streamed and which are marked finished.
+ * Must be called after the simulation is set up and before its nodes are simulated.
+ * @params:
+ *   sim: simulation, set up as when the snapshot was taken
+ *   fin: snapshot
+ *   procs: the workload's processes, in workload order
+ *   num_procs: number of processes
+ * @returns:
+ *   1 on success, 0 if the snapshot is corrupt or does not match the simulation and workload
+ */
+extern int process_restore(sim_t *sim, FILE *fin, context **procs, int num_procs) {
+    size_t len;
+    unsigned char *bytes = snap_read_all(fin, &len);
+
+    /* The hash at the end is checked before anything is read, so that no damaged snapshot is restored
      */
-    while (!prio_q_empty(node->ready) || !prio_q_empty(node->blocked) || cur != NULL) {
-        int preempt = 0;
+    if (len < 12 || memcmp(bytes, SNAPSHOT_MAGIC, 8) ||
+        fnv_add(FNV_BASIS, bytes, len - 4) != (bytes[len - 4] | bytes[len - 3] << 8 | bytes[len - 2] << 16 |
+                                                (unsigned int) bytes[len - 1] << 24)) {
+        free(bytes);
+        return 0;
+    }
 
-        /* Step 1: Unblock processes
-         * If any of the unblocked processes have higher priority than current running process
-         *   we will need to preempt the current running process
-         */
-        while (!prio_q_empty(node->blocked)) {
-            /* We can stop ff process at head of queue should not be unblocked
-             */
-            context *proc = prio_q_peek(node->blocked);
-            if (proc->duration > node->node_clock) {
-                break;
+    snapshot_t s = {.p = bytes + 8, .end = bytes + len - 4, .ok = 1, .procs = procs, .num_procs = num_procs,
+                    .restored = calloc(num_procs > 0 ? num_procs : 1, 1)};
+    unsigned int *fingerprints = malloc(sim->num_nodes * sizeof(unsigned int));
+    assert(s.restored && fingerprints);
+
+    if (snap_get(&s) != SNAPSHOT_VERSION || snap_get(&s) != sim->num_nodes || snap_get(&s) != sim->quantum ||
+        snap_get(&s) != sim->balance_interval || snap_get(&s) != sim->migrate_cost || snap_get(&s) != sim->policy) {
+        s.ok = 0;
+    }
+    int clock = snap_get(&s);
+    if (clock < 0) {
+        s.ok = 0;
+    }
+    if (sim->checkpoint_interval > 0) {
+        sim->next_checkpoint = clock + sim->checkpoint_interval;
+    }
+
+    /* Each node must have admitted the same processes before the snapshot as with the workload it was taken of
+     */
+    for (int i = 0; i < sim->num_nodes; i++) {
+        fingerprints[i] = FNV_BASIS;
+    }
+    for (int i = 0; i < num_procs; i++) {
+        context *proc = procs[i];
+        if (proc->arrival < clock && proc->node >= 1 && proc->node <= sim->num_nodes) {
+            fingerprints[proc->node - 1] = fingerprint_add(fingerprints[proc->node - 1], proc);
+        }
+    }
+
+    for (int i = 0; i < sim->num_nodes && s.ok; i++) {
+        node_data_t *node = &sim->nodes[i];
+        node->node_clock = clock;
+        node->window_end = clock + sim->window;
+        atomic_store(&node->stream.clock, clock);
+        if (snap_get(&s) != node->num_cpus || (unsigned int) snap_get(&s) != fingerprints[i]) {
+            s.ok = 0;
+            break;
+        }
+        node->fingerprint = fingerprints[i];
+        node->next_proc_id = snap_get(&s);
+        node->vclock = snap_get(&s);
+        if (node->next_proc_id < 1) {
+            s.ok = 0;
+        }
+        for (int c = 0; c < node->num_cpus && s.ok; c++) {
+            cpu_t *cpu = &node->cpus[c];
+            if (snap_get(&s)) {
+                cpu->cur = load_context(&s, node, PROC_RUNNING, cpu);
+                node->running++;
+            }
+            cpu->quantum = snap_get(&s);
+            cpu->preempt = snap_get(&s);
+            if (cpu->quantum < 0 || (cpu->preempt != 0 && cpu->preempt != 1)) {
+                s.ok = 0;
+            }
+            cpu->queued = load_queue(&s, node, cpu->ready, ready_keys[sim->policy], PROC_READY, cpu);
+            node->queued += cpu->queued;
+        }
+        load_blocked(&s, node);
+        node->incoming = load_queue(&s, node, node->transit, transit_key, PROC_MIGRATING, NULL);
+        int finished = snap_get(&s);
+        for (int j = 0; j < finished && s.ok; j++) {
+            context *proc = load_context(&s, node, PROC_FINISHED, NULL);
+            if (proc) {
+                finished_append(node, proc);
             }
+        }
+    }
 
-            /* Move from blocked and reinsert into appropriate queue
-             */
-            prio_q_remove(node->blocked);
-            insert_in_queue(proc, 1);
+    /* The processes are put back with their place in the workload, for the next snapshot
+     */
+    for (int i = 0; i < num_procs; i++) {
+        procs[i]->cold->index = i;
+    }
 
-            /* preemption is necessary if a process is running, and it has lower priority than
-             * a newly unblocked ready process.
-             */
-            preempt |= cur != NULL && proc->state == PROC_READY &&
-                       actual_priority(cur) > actual_priority(proc);
+    /* A process that arrived before the snapshot but is not in it finished, and its statistics were
+     * written out, while streaming
+     */
+    for (int i = 0; i < num_procs; i++) {
+        if (!s.restored[i] && procs[i]->arrival < clock) {
+            procs[i]->state = PROC_FINISHED;
+        }
+    }
+    int ok = s.ok && s.p == s.end;
+    free(bytes);
+    free(s.restored);
+    free(fingerprints);
+    return ok;
+}
+
+/* Close a window once every node has reached its end: check whether the simulation is over, and if not,
+ * balance the load and take a snapshot, if either is due
+ * @params:
+ *   sim: simulation, with every node at the end of the window
+ *   window_end: clock at the end of the window
+ * @returns:
+ *   none
+ */
+static void window_close(sim_t *sim, int window_end) {
+    int active = 0;
+    for (int i = 0; i < sim->num_nodes && !active; i++) {
+        active = node_active(&sim->nodes[i]);
+    }
+    sim->all_done = !active;
+    if (active && sim->balance_interval > 0) {
+        balance(sim);
+    }
+    if (active && sim->checkpoint_interval > 0 && window_end >= sim->next_checkpoint) {
+        checkpoint(sim, window_end);
+        while (sim->next_checkpoint <= window_end) {
+            sim->next_checkpoint += sim->checkpoint_interval;
         }
+    }
+}
+
+/* Wait for all the nodes to reach the end of the window, let the last one to arrive close it,
+ * and wait for it to be done.
+ * @params:
+ *   node: node being simulated, at the end of its window
+ * @returns:
+ *   1 if every node is done and the simulation is over, 0 otherwise
+ */
+static int window_barrier_wait(node_data_t *node) {
+    sim_t *sim = node->sim;
+    if (pthread_barrier_wait(&sim->window_barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+        window_close(sim, node->window_end);
+    }
+    pthread_barrier_wait(&sim->window_barrier);
+    node->window_end += sim->window;
+    return sim->all_done;
+}
+
+/* Simulate one tick of a node at its clock, then advance the clock to the next tick at which
+ * something can happen, or by one tick with the tick engine
+ * @params:
+ *   node: node being simulated
+ *   policy: scheduling policy
+ * @returns:
+ *   none
+ */
+POLICY_INLINE void node_tick(node_data_t *node, int policy) {
+    context *proc;
+
+    METRIC_ADD(node, iterations, 1);
+
+    /* Step 0: Admit the processes arriving at this tick
+     * If the next process has not been routed to the node yet, wait for it, since it may arrive now,
+     * unless the clock is before the horizon.
+     * Arriving processes preempt the running process just like unblocked ones.
+     */
+    while ((proc = inbox_peek(&node->inbox, node->node_clock >= node->horizon)) != NULL &&
+           proc->arrival <= node->node_clock) {
+        inbox_pop(&node->inbox);
+        admit(node, proc, policy);
+        check_preempt(node, proc, policy);
+    }
 
-        /* Step 2: Update current running process
+    /* Step 1: Unblock processes
+     * If any of the unblocked processes have higher priority than the process running on
+     *   the CPU it is queued on, we will need to preempt that process
+     */
+    while ((proc = blocked_due(node)) != NULL) {
+        /* Move from blocked and reinsert into appropriate queue
          */
+        insert_in_queue(node, proc, 1, policy);
+        check_preempt(node, proc, policy);
+    }
+
+    /* Step 1b: Queue the processes that have finished migrating to this node
+     */
+    while (!prio_q_empty(node->transit) &&
+           ((context *) prio_q_peek(node->transit))->enqueue_time <= node->node_clock) {
+        proc = prio_q_remove(node->transit);
+        node->incoming--;
+        insert_in_queue(node, proc, 0, policy);
+        check_preempt(node, proc, policy);
+    }
+
+    /* Step 2: Update the running process of each CPU
+     */
+    for (int c = 0; c < node->num_cpus; c++) {
+        cpu_t *cpu = &node->cpus[c];
+        context *cur = cpu->cur;
         if (cur != NULL) {
             cur->duration--;
-            cpu_quantum--;
+            cpu->quantum--;
 
             /* Process stops running if it is preempted, has used up their quantum, or has completed its DOOP
              */
-            if (cur->duration == 0 || cpu_quantum == 0 || preempt) {
-                insert_in_queue(cur, cur->duration == 0);
-                cur = NULL;
+            if (cur->duration == 0 || cpu->quantum == 0 || cpu->preempt) {
+                METRIC_ADD(node, preemptions, cur->duration != 0 && cpu->quantum != 0);
+                policy_tick(node, cpu, cur, policy);
+                cpu->cur = NULL;
+                node->running--;
+                insert_in_queue(node, cur, cur->duration == 0, policy);
+            }
+        }
+        cpu->preempt = 0;
+    }
+
+    /* Step 3: Select next ready process to run on each idle CPU
+     * Idle CPUs first run their own queued processes, then those with nothing queued
+     * take the head of their busiest sibling's queue.
+     */
+    for (int c = 0; c < node->num_cpus && node->queued > 0; c++) {
+        if (node->cpus[c].cur == NULL && node->cpus[c].queued > 0) {
+            run_next(node, c, &node->cpus[c], policy);
+        }
+    }
+    for (int c = 0; c < node->num_cpus && node->queued > 0; c++) {
+        if (node->cpus[c].cur == NULL) {
+            METRIC_ADD(node, steals, 1);
+            run_next(node, c, busiest_cpu(node), policy);
+        }
+    }
+
+    /* Step 4: Advance the clock
+     * The event-driven engine skips the ticks in which nothing but the running processes' durations
+     * and quanta would change, and charges those ticks to the running processes up front.
+     */
+    int delta = 1;
+    if (node->sim->engine == ENGINE_EVENT) {
+        delta = next_event(node);
+        for (int c = 0; c < node->num_cpus; c++) {
+            cpu_t *cpu = &node->cpus[c];
+            if (cpu->cur != NULL) {
+                cpu->cur->duration -= delta - 1;
+                cpu->quantum -= delta - 1;
+            }
+        }
+    }
+    METRIC_ADD(node, idle_ticks, (unsigned long long) delta * (node->num_cpus - node->running));
+    node->busy_ticks += (unsigned long long) delta * node->running;
+    node->node_clock += delta;
+    if (node->sim->stream_out) {
+        stream_handoff(node, node->node_clock);
+    } else if (node->dist) {
+        dist_record(node);
+    }
+}
+
+/* Get a node ready to be simulated, on the thread simulating it, which first touches the node's trace buffer
+ * @params:
+ *   node: node about to be simulated
+ * @returns:
+ *   none
+ */
+static void node_start(node_data_t *node) {
+    trace_start(&node->trace, &node->arena);
+    METRIC_TIMER_START(node);
+}
+
+/* Wrap up the simulation of a node once it has nothing left to simulate
+ * @params:
+ *   node: node being simulated
+ * @returns:
+ *   none
+ */
+static void node_done(node_data_t *node) {
+    if (node->sim->stream_out) {
+        stream_handoff(node, INT_MAX);
+    } else if (node->dist) {
+        dist_record(node);
+    }
+    trace_finish(&node->trace);
+    METRIC_TIMER_STOP(node);
+}
+
+/* Simulate a node until its clock reaches end or, outside of balancing windows, it has nothing left to simulate,
+ * with a copy of the simulation loop for each scheduling policy
+ * @params:
+ *   node: node being simulated
+ *   end: clock at which to stop
+ * @returns:
+ *   none
+ */
+#define POLICY_RUN(id, name, description) \
+    static void node_run_##id(node_data_t *node, int end) { \
+        int windowed = node->sim->window > 0; \
+        while (node->node_clock < end && (windowed || node_active(node))) { \
+            node_tick(node, id); \
+        } \
+    }
+PROCESS_POLICIES(POLICY_RUN)
+#undef POLICY_RUN
+
+static void (*const node_runs[POLICY_COUNT])(node_data_t *node, int end) = {
+#define POLICY_RUN_ENTRY(id, name, description) node_run_##id,
+    PROCESS_POLICIES(POLICY_RUN_ENTRY)
+#undef POLICY_RUN_ENTRY
+};
+
+/* Perform the simulation of a node
+ * @params:
+ *   sim: simulation
+ *   node_id: node to simulate, starting at 1
+ * @returns:
+ *   none
+ */
+extern void node_simulate(sim_t *sim, int node_id) {
+
+    /*
+     * Threads are created for each node to simulate in increasing order of node_id
+     * All the process simulated in each node and node_id is used to keep tracks of queues
+     * Context switching will only affect the order of output,
+     * but will not make any difference in process simulation
+     */
+    node_data_t *node = &sim->nodes[node_id - 1];
+
+    node_start(node);
+
+    /* We can only stop when all processes are in the finished state
+     * no processes are readdy, running, or blocked, and no more processes will arrive.
+     * When balancing, the nodes keep going window by window until they are all done,
+     * since an idle node may be given processes to run.
+     */
+    for (;;) {
+        if (sim->window > 0) {
+            if (node->node_clock == node->window_end && window_barrier_wait(node)) {
+                break;
             }
+        } else if (!node_active(node)) {
+            break;
         }
+        node_runs[sim->policy](node, sim->window > 0 ? node->window_end : INT_MAX);
+    }
+    node_done(node);
+}
+
+/* Simulate a group of nodes on the calling thread, in lock step windows of BATCH_WINDOW ticks: each window starts
+ * at the earliest clock of the group's nodes, and the nodes with something to do before the window ends are
+ * simulated up to its end, one after the other.  The nodes are picked by looking only at the clock of each one's
+ * next tick, which is kept in an array of its own.
+ * @params:
+ *   sim: simulation, without balancing windows
+ *   first_id: first node of the group, starting at 1
+ *   count: number of nodes in the group
+ * @returns:
+ *   none
+ */
+extern void node_simulate_batch(sim_t *sim, int first_id, int count) {
+    node_data_t *nodes = &sim->nodes[first_id - 1];
+    int *next = malloc(count * sizeof(int));    /* clock of each node's next tick, INT_MAX once it is done */
+    int *due = malloc(count * sizeof(int));     /* nodes with a tick in the window */
+    assert(next && due);
+    assert(sim->window == 0);
+
+    for (int i = 0; i < count; i++) {
+        node_start(&nodes[i]);
+        next[i] = nodes[i].node_clock;
+    }
 
-        /* Step 3: Select next ready process to run if none are running
-         * Be sure to keep track of how long it waited in the ready queue
+    for (;;) {
+        /* Find the window and the nodes due in it, branch free so that the compiler can vectorize
+         * both passes over the nodes
          */
-        if (cur == NULL && !prio_q_empty(node->ready)) {
-            cur = prio_q_remove(node->ready);
-            cur->wait_time += node->node_clock - cur->enqueue_time;
-            cpu_quantum = quantum;
-            cur->state = PROC_RUNNING;
-            print_process(cur);
+        int start = INT_MAX;
+        for (int i = 0; i < count; i++) {
+            start = next[i] < start ? next[i] : start;
+        }
+        if (start == INT_MAX) {
+            break;
+        }
+        int end = start < INT_MAX - BATCH_WINDOW ? start + BATCH_WINDOW : INT_MAX;
+        int num_due = 0;
+        for (int i = 0; i < count; i++) {
+            due[num_due] = i;
+            num_due += next[i] < end;
         }
 
-        /* next clock tick
-        */
-        node->node_clock++;
+        for (int d = 0; d < num_due; d++) {
+            node_data_t *node = &nodes[due[d]];
+            node_runs[sim->policy](node, end);
+            if (node_active(node)) {
+                next[due[d]] = node->node_clock;
+            } else {
+                node_done(node);
+                next[due[d]] = INT_MAX;
+            }
+        }
+    }
+    free(next);
+    free(due);
+}
+
+/* Simulate a node on the calling thread until its clock reaches a time, for node_run_until and process_run_until.
+ * The node's events so far are then written out or handed to the sink.
+ * @params:
+ *   node: node to simulate
+ *   until: clock at which to stop, every process arriving on the node before it must have been routed
+ * @returns:
+ *   1 if the node has anything left to simulate, 0 once it is done, which is only decided at the end of a window
+ *   when balancing or taking snapshots
+ */
+static int node_advance(node_data_t *node, int until) {
+    sim_t *sim = node->sim;
+    if (node->done) {
+        return 0;
+    }
+    if (!node->started) {
+        node_start(node);
+        node->started = 1;
+    }
+
+    node->horizon = until;
+    node_runs[sim->policy](node, until);
+    if (sim->window == 0 && !node_active(node)) {
+        node_done(node);
+        node->done = 1;
+        return 0;
+    }
+    trace_finish(&node->trace);
+    return 1;
+}
+
+/* Simulate a node on the calling thread until its clock reaches a time or it has nothing left to simulate.
+ * The clock may end up past the time if nothing happens on the node in between.  Cannot be used with balancing
+ * or snapshots, see process_run_until.
+ * @params:
+ *   sim: simulation
+ *   node_id: node to simulate, starting at 1
+ *   until: clock at which to stop, INT_MAX to simulate the node to completion once process_submit_done has been
+ *          called, every process arriving on the node before it must have been routed
+ * @returns:
+ *   1 if the node has anything left to simulate, 0 otherwise
+ */
+extern int node_run_until(sim_t *sim, int node_id, int until) {
+    assert(sim->window == 0);
+    return node_advance(&sim->nodes[node_id - 1], until);
+}
+
+/* Simulate every node on the calling thread, one after the other, until their clocks reach a time or they have
+ * nothing left to simulate.  With balancing or snapshots, the nodes advance window by window, and the windows are
+ * closed as they would be at the barrier.
+ * @params:
+ *   sim: simulation
+ *   until: clock at which to stop, INT_MAX to simulate the nodes to completion once process_submit_done has been
+ *          called, every process arriving before it must have been routed
+ * @returns:
+ *   1 if any node has anything left to simulate, 0 otherwise
+ */
+extern int process_run_until(sim_t *sim, int until) {
+    int active;
+    int end;
+    do {
+        end = sim->window > 0 && sim->nodes[0].window_end < until ? sim->nodes[0].window_end : until;
+        active = 0;
+        for (int i = 0; i < sim->num_nodes; i++) {
+            active |= node_advance(&sim->nodes[i], end);
+        }
+
+        if (sim->window > 0 && end == sim->nodes[0].window_end) {
+            window_close(sim, end);
+            for (int i = 0; i < sim->num_nodes; i++) {
+                sim->nodes[i].window_end += sim->window;
+                if (sim->all_done && !sim->nodes[i].done) {
+                    node_done(&sim->nodes[i]);
+                    sim->nodes[i].done = 1;
+                }
+            }
+            active = !sim->all_done;
+        }
+    } while (active && end < until);
+    return active;
+}
+
+/* Returns the clock of a node
+ * @params:
+ *   sim: simulation
+ *   node_id: node, starting at 1
+ * @returns:
+ *   the clock of the node's next tick, only meaningful between the runs of the node
+ */
+extern int process_clock(sim_t *sim, int node_id) {
+    return sim->nodes[node_id - 1].node_clock;
+}
+
+/* Outputs one row of summary statistics: the makespan, the mean and largest time a process
+ * spent waiting in a ready queue, and the time at which the last process finished on each node
+ * @params:
+ *   sim: simulation, after all its nodes have been simulated
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void process_summary(sim_t *sim, FILE *fout) {
+    long long total_wait = 0;
+    int max_wait = 0;
+    int count = 0;
+    int makespan = 0;
+
+    for (int i = 0; i < sim->num_nodes; i++) {
+        node_data_t *node = &sim->nodes[i];
+        for (int j = 0; j < node->finished_count; j++) {
+            int wait = node->finished[j]->wait_time;
+            total_wait += wait;
+            max_wait = wait > max_wait ? wait : max_wait;
+        }
+        count += node->finished_count;
+        if (node->finished_count > 0 && node->finished[node->finished_count - 1]->cold->finish_time > makespan) {
+            makespan = node->finished[node->finished_count - 1]->cold->finish_time;
+        }
+    }
+
+    fprintf(fout, "%8d %10.2f %8d ", makespan, count ? (double) total_wait / count : 0.0, max_wait);
+    for (int i = 0; i < sim->num_nodes; i++) {
+        node_data_t *node = &sim->nodes[i];
+        fprintf(fout, " %d", node->finished_count ? node->finished[node->finished_count - 1]->cold->finish_time : 0);
+    }
+    fputc('\n', fout);
+}
+
+/* Output one row per distribution of a node or the whole cluster
+ * @params:
+ *   fout: FILE into which the output should be written
+ *   label: node number or "all"
+ *   dist: distributions
+ *   util: percentage of the CPU ticks spent running processes
+ * @returns:
+ *   none
+ */
+static void dist_rows(FILE *fout, const char *label, dist_t *dist, double util) {
+    const char *names[] = {"wait", "block", "turnaround", "response"};
+    hist_t *hists[] = {&dist->wait, &dist->block, &dist->turnaround, &dist->response};
+    for (int i = 0; i < 4; i++) {
+        fprintf(fout, "%4s %8llu %6.1f%%  %-10s %8d %8d %8d %8d\n", label, dist->turnaround.count, util, names[i],
+                hist_percentile(hists[i], 50), hist_percentile(hists[i], 90), hist_percentile(hists[i], 99),
+                hists[i]->max);
     }
-    return NULL;
 }
 
-/* pulls the processes from finished queue in FIFO and calls Context_stats for each process in that order
+/* Outputs the 50th, 90th and 99th percentiles and the largest of the wait, block, turnaround and response times
+ * of the processes, and the CPU utilization, of each node and of the whole cluster.  The utilization is
+ * over the time until the last process finished.  Only in quiet mode.
  * @params:
+ *   sim: simulation, after all its nodes have been simulated
  *   fout: FILE into which the output should be written
  * @returns:
  *   none
  */
-extern void node_stats(FILE *fout) {
+extern void process_distributions(sim_t *sim, FILE *fout) {
+    char label[16];
+    dist_t *all = calloc(1, sizeof(dist_t));
+    assert(all);
+    unsigned long long busy = 0, cpus = 0;
+    int makespan = 0;
+
+    fprintf(fout, "%4s %8s %7s  %-10s %8s %8s %8s %8s\n", "node", "procs", "util", "metric", "p50", "p90", "p99",
+            "max");
+    for (int i = 0; i < sim->num_nodes; i++) {
+        node_data_t *node = &sim->nodes[i];
+        double span = (double) node->num_cpus * node->finish_time;
+        snprintf(label, sizeof(label), "%02d", node->node_id);
+        dist_rows(fout, label, node->dist, span > 0 ? 100.0 * node->busy_ticks / span : 0.0);
 
-    while (!prio_q_empty(finished)) {
-        context *proc = prio_q_remove(finished);
-        context_stats(proc, stdout);
+        /* The node threads are done, so their histograms can be read without locking
+         */
+        hist_merge(&all->wait, &node->dist->wait);
+        hist_merge(&all->block, &node->dist->block);
+        hist_merge(&all->turnaround, &node->dist->turnaround);
+        hist_merge(&all->response, &node->dist->response);
+        busy += node->busy_ticks;
+        cpus += node->num_cpus;
+        makespan = node->finish_time > makespan ? node->finish_time : makespan;
+    }
+    double span = (double) cpus * makespan;
+    dist_rows(fout, "all", all, span > 0 ? 100.0 * busy / span : 0.0);
+    free(all);
+}
+
+/* Outputs the peak memory use of each node's arena
+ * @params:
+ *   sim: simulation
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void process_report(sim_t *sim, FILE *fout) {
+    char name[16];
+    for (int i = 0; i < sim->num_nodes; i++) {
+        snprintf(name, sizeof(name), "node %02d", sim->nodes[i].node_id);
+        arena_report(&sim->nodes[i].arena, name, fout);
     }
+}
 
+/* Outputs the hot path counters of each node as JSON
+ * @params:
+ *   sim: simulation
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   1 on success, 0 if the counters were compiled out
+ */
+extern int process_metrics(sim_t *sim, FILE *fout) {
+#if PROSIM_METRICS
+    fprintf(fout, "{\"nodes\": [");
+    for (int i = 0; i < sim->num_nodes; i++) {
+        node_metrics_t *m = &sim->nodes[i].metrics;
+        fprintf(fout, "%s\n  {\"node\": %d, \"iterations\": %llu, \"idle_ticks\": %llu, \"preemptions\": %llu, "
+                      "\"steals\": %llu, \"migrations\": %llu, "
+                      "\"ready\": {\"inserts\": %llu, \"removes\": %llu, \"max_depth\": %d}, "
+                      "\"blocked\": {\"inserts\": %llu, \"removes\": %llu, \"max_depth\": %d}, "
+                      "\"wall_s\": %.6f}",
+                i ? "," : "", sim->nodes[i].node_id, m->iterations, m->idle_ticks, m->preemptions,
+                m->steals, m->migrations,
+                m->ready.inserts, m->ready.removes, m->ready.max_depth,
+                m->blocked.inserts, m->blocked.removes, m->blocked.max_depth, m->wall);
+    }
+    fprintf(fout, "\n]}\n");
+    return 1;
+#else
+    return 0;
+#endif
+}
 
-}
\ No newline at end of file
+/* Frees all the memory of the simulation: the nodes, their queues, trace buffers and finished lists
+ * @params:
+ *   sim: simulation
+ * @returns:
+ *   none
+ */
+extern void process_free(sim_t *sim) {
+    for (int i = 0; i < sim->num_nodes; i++) {
+        pthread_mutex_destroy(&sim->nodes[i].inbox.lock);
+        pthread_cond_destroy(&sim->nodes[i].inbox.cond);
+        pthread_mutex_destroy(&sim->nodes[i].stream.lock);
+        free(sim->nodes[i].stream.handoff);
+        free(sim->nodes[i].stream.pending);
+        arena_free_all(&sim->nodes[i].arena);
+    }
+    arena_free_all(&sim->submit_arena);
+    pthread_mutex_destroy(&sim->stream_lock);
+    free(sim->stream_lists);
+    free(sim->stream_counts);
+    free(sim->stream_pos);
+    if (sim->window > 0) {
+        pthread_barrier_destroy(&sim->window_barrier);
+    }
+    free(sim->nodes);
+    free(sim);
+}
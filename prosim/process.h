@@ -6,36 +6,344 @@
 #define PROSIM_PROCESS_H
 
 #include "context.h"
+#include "trace.h"
+
+/* Clock advance strategies for node_simulate
+ */
+enum {
+    ENGINE_EVENT = 0,   /* jump straight to the next tick at which a process changes state */
+    ENGINE_TICK         /* advance the clock one tick at a time */
+};
+
+/* How each node holds its blocked processes
+ */
+enum {
+    BLOCKED_QUEUE = 0,  /* priority queue ordered by wake-up time */
+    BLOCKED_WHEEL       /* hierarchical timing wheel, constant time to block a process */
+};
+
+/* Scheduling policies, as X(id, name, description), the name selects the policy on the command line and in the
+ * workload header.  The policies decide the order of each CPU's ready queue, how long a process may run before it
+ * goes back to the queue, and which newly ready processes preempt the running one.
+ */
+#define PROCESS_POLICIES(X) \
+    X(POLICY_PRIORITY, "priority", "static priorities, shortest DOOP first for negative ones, preemptive, with a quantum") \
+    X(POLICY_FIFO, "fifo", "first come first served, each DOOP runs to completion") \
+    X(POLICY_RR, "rr", "round robin, first come first served with a quantum") \
+    X(POLICY_SRTF, "srtf", "shortest remaining DOOP first, preemptive") \
+    X(POLICY_MLFQ, "mlfq", "multilevel feedback queue, processes using up their quantum drop a level") \
+    X(POLICY_FAIR, "fair", "fair share, the process that has run the least runs next, with a quantum")
+
+enum {
+#define POLICY_ENUM(id, name, description) id,
+    PROCESS_POLICIES(POLICY_ENUM)
+#undef POLICY_ENUM
+    POLICY_COUNT
+};
+
+/* A simulation of a set of nodes.  Simulations share nothing but the trace output settings,
+ * so several can be run at the same time.
+ */
+typedef struct sim sim_t;
+
 /* Initialize the simulation
  * @params:
  *   quantum: the CPU quantum to use in the situation
+ *   num_nodes: number of nodes
  * @returns:
- *   returns 1
+ *   the new simulation
+ */
+extern sim_t *process_init(int cpu_quantum, int num_nodes);
+
+/* Most CPUs a node can have, the binary trace stores the CPU in a byte
+ */
+#define PROCESS_CPUS_MAX 255
+
+/* Set the number of CPUs of a node, must be called before the node is simulated
+ * @params:
+ *   sim: simulation
+ *   node_id: node number, starting at 1
+ *   count: number of CPUs, 1 to PROCESS_CPUS_MAX
+ * @returns:
+ *   1 on success, 0 if the node or count is out of range
+ */
+extern int process_set_cpus(sim_t *sim, int node_id, int count);
+
+/* Turn on cross-node balancing, must be called before the nodes are simulated.  The nodes then
+ * advance in lock step windows and must all be simulated at the same time, one thread per node,
+ * or all of them on one thread by process_run_until.
+ * @params:
+ *   sim: simulation
+ *   interval: ticks between balancing rounds, at least 1
+ *   cost: ticks a process spends moving to another node
+ * @returns:
+ *   none
+ */
+extern void process_set_balance(sim_t *sim, int interval, int cost);
+
+/* Take a snapshot of the simulation every so often, must be called before the nodes are simulated
+ * and after process_set_balance, whose window the snapshots are then taken at the end of.  The nodes then advance
+ * in lock step windows and must all be simulated at the same time, one thread per node, or all of them on one
+ * thread by process_run_until.
+ * @params:
+ *   sim: simulation
+ *   path: file to which the snapshots are written, each replacing the previous one
+ *   interval: ticks between snapshots, at least 1
+ * @returns:
+ *   none
+ */
+extern void process_set_checkpoint(sim_t *sim, const char *path, int interval);
+
+/* Restore a simulation from a snapshot.  The snapshot's processes are put back on their nodes,
+ * the workload's other processes have yet to arrive and must then be routed with process_submit, except for
+ * those that arrived before the snapshot, whose statistics were streamed and which are marked finished.
+ * Must be called after the simulation is set up and before its nodes are simulated.
+ * @params:
+ *   sim: simulation, set up as when the snapshot was taken
+ *   fin: snapshot
+ *   procs: the workload's processes, in workload order
+ *   num_procs: number of processes
+ * @returns:
+ *   1 on success, 0 if the snapshot is corrupt or does not match the simulation and workload
+ */
+extern int process_restore(sim_t *sim, FILE *fin, context **procs, int num_procs);
+
+/* Select how node_simulate advances the node clock, must be called before node_simulate
+ * @params:
+ *   sim: simulation
+ *   mode: ENGINE_EVENT (default) or ENGINE_TICK
+ * @returns:
+ *   none
+ */
+extern void process_set_engine(sim_t *sim, int mode);
+
+/* Look up a scheduling policy by name
+ * @params:
+ *   name: name of the policy, see PROCESS_POLICIES
+ * @returns:
+ *   the policy, or -1 if there is no policy with that name
+ */
+extern int process_policy(const char *name);
+
+/* Select the scheduling policy, must be called before any process is admitted
+ * @params:
+ *   sim: simulation
+ *   policy: one of PROCESS_POLICIES, POLICY_PRIORITY by default
+ * @returns:
+ *   none
+ */
+extern void process_set_policy(sim_t *sim, int policy);
+
+/* Select how each node holds its blocked processes, must be called before any process is admitted
+ * @params:
+ *   sim: simulation
+ *   impl: BLOCKED_QUEUE (default) or BLOCKED_WHEEL
+ * @returns:
+ *   none
+ */
+extern void process_set_blocked(sim_t *sim, int impl);
+
+/* Write out the statistics of the processes while the nodes are simulated, must be called before the nodes
+ * are simulated.  A process' statistics are written once the clocks of all the nodes have passed its finish time,
+ * in the same order as node_stats, and its context is then released.
+ * @params:
+ *   sim: simulation
+ *   fout: FILE into which the statistics should be written
+ *   release: called with arg for each process whose statistics have been written, from any thread, or NULL.
+ *            Processes made by process_create are not passed to it.
+ *   arg: argument of release
+ * @returns:
+ *   none
+ */
+extern void process_set_stream(sim_t *sim, FILE *fout, void (*release)(void *arg, context *proc), void *arg);
+
+/* Only keep the distributions of the processes' times instead of writing out the trace and the statistics of
+ * each process, must be called before the nodes are simulated.  Finished processes are released at the end
+ * of the tick in which they finish.
+ * @params:
+ *   sim: simulation
+ *   release: called with arg for each finished process not made by process_create, from any thread, or NULL
+ *   arg: argument of release
+ * @returns:
+ *   none
+ */
+extern void process_set_quiet(sim_t *sim, void (*release)(void *arg, context *proc), void *arg);
+
+/* Hand the state transitions of the processes to a sink instead of writing out the trace, must be called before
+ * the nodes are simulated
+ * @params:
+ *   sim: simulation
+ *   sink: receives each node's transitions in order, in batches, from the thread simulating the node
+ *   arg: argument of sink
+ * @returns:
+ *   none
  */
-extern int process_init(int cpu_quantum, int num_nodes);
+extern void process_set_events(sim_t *sim, trace_sink_t sink, void *arg);
 
-/* Admit a process into the simulation
+/* Admit a process into the simulation at time 0, before the nodes are simulated
  * @params:
+ *   sim: simulation
  *   proc: pointer to the program context of the process to be admitted
  * @returns:
  *   returns 1
  */
-extern int process_admit(context *proc);
+extern int process_admit(sim_t *sim, context *proc);
 
-/* Perform the simulation
+/* Create a process running a program given as an array of primitives, for process_submit.  The context lives
+ * until the simulation is freed, and is never handed to the release callback of process_set_stream or
+ * process_set_quiet.  Its place in the workload counts the processes made by process_create, so they should not be
+ * mixed with loaded ones in a checkpointed simulation.  Must be called from the thread routing the processes.
  * @params:
+ *   sim: simulation
+ *   name: program name, at most 10 characters are kept
+ *   ops: the program's primitives, ending with OP_HALT
+ *   size: number of primitives
+ *   priority: process priority
+ *   node: node on which the process is to be simulated
+ *   arrival: time at which the process arrives on its node
+ * @returns:
+ *   the new process, or NULL if the program is malformed
+ */
+extern context *process_create(sim_t *sim, const char *name, const opcode *ops, int size, int priority, int node,
+                               int arrival);
+
+/* Route a process to its node, which admits it once its clock reaches the arrival time.
+ * May be called while the nodes are being simulated.  Arrival times must not decrease on any node.
+ * @params:
+ *   sim: simulation
+ *   proc: pointer to the program context of the process
+ * @returns:
+ *   1 on success, 0 if the process cannot be routed
+ */
+extern int process_submit(sim_t *sim, context *proc);
+
+/* Tell the nodes that no more processes will be routed to them
+ * @params:
+ *   sim: simulation
+ * @returns:
  *   none
+ */
+extern void process_submit_done(sim_t *sim);
+
+/* Perform the simulation of a node
+ * @params:
+ *   sim: simulation
+ *   node_id: node to simulate, starting at 1
  * @returns:
- *   returns 1
+ *   none
+ */
+extern void node_simulate(sim_t *sim, int node_id);
+
+/* Perform the simulation of a group of nodes on the calling thread, in lock step, for workloads with
+ * many small nodes.  Cannot be used with balancing or snapshots.
+ * @params:
+ *   sim: simulation
+ *   first_id: first node of the group, starting at 1
+ *   count: number of nodes in the group
+ * @returns:
+ *   none
+ */
+extern void node_simulate_batch(sim_t *sim, int first_id, int count);
+
+/* Simulate a node on the calling thread until its clock reaches a time or it has nothing left to simulate.
+ * The clock may end up past the time if nothing happens on the node in between.  Cannot be used with balancing
+ * or snapshots, see process_run_until.
+ * @params:
+ *   sim: simulation
+ *   node_id: node to simulate, starting at 1
+ *   until: clock at which to stop, INT_MAX to simulate the node to completion once process_submit_done has been
+ *          called, every process arriving on the node before it must have been routed
+ * @returns:
+ *   1 if the node has anything left to simulate, 0 otherwise
+ */
+extern int node_run_until(sim_t *sim, int node_id, int until);
+
+/* Simulate every node on the calling thread, one after the other, until their clocks reach a time or they have
+ * nothing left to simulate.  With balancing or snapshots, the nodes advance window by window, and the windows are
+ * closed as they would be at the barrier.
+ * @params:
+ *   sim: simulation
+ *   until: clock at which to stop, INT_MAX to simulate the nodes to completion once process_submit_done has been
+ *          called, every process arriving before it must have been routed
+ * @returns:
+ *   1 if any node has anything left to simulate, 0 otherwise
+ */
+extern int process_run_until(sim_t *sim, int until);
+
+/* Returns the clock of a node
+ * @params:
+ *   sim: simulation
+ *   node_id: node, starting at 1
+ * @returns:
+ *   the clock of the node's next tick, only meaningful between the runs of the node
+ */
+extern int process_clock(sim_t *sim, int node_id);
+
+/* Write out the statistics of the processes that every node's clock has passed the finish time of,
+ * while the nodes are being simulated, see process_set_stream
+ * @params:
+ *   sim: simulation
+ *   wait: 0 to write out what can be written now, 1 to keep going until every node is done
+ * @returns:
+ *   none
+ */
+extern void process_stream(sim_t *sim, int wait);
+
+/* Merges the per-node finished lists and calls Context_stats for each process in finishing order.
+ * When streaming, the statistics have already been written and only the trace is left to write out.
+ * @params:
+ *   sim: simulation, after all its nodes have been simulated
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void node_stats(sim_t *sim, FILE *fout);
+
+/* Outputs the 50th, 90th and 99th percentiles and the largest of the wait, block, turnaround and response times
+ * of the processes, and the CPU utilization, of each node and of the whole cluster.  The utilization is
+ * over the time until the last process finished.  Only in quiet mode.
+ * @params:
+ *   sim: simulation, after all its nodes have been simulated
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
  */
-void *node_simulate(void *arg);
+extern void process_distributions(sim_t *sim, FILE *fout);
 
-/* pulls the processes from finished queue in FIFO and calls Context_stats for each process in that order
+/* Outputs one row of summary statistics: the makespan, the mean and largest time a process
+ * spent waiting in a ready queue, and the time at which the last process finished on each node
  * @params:
+ *   sim: simulation, after all its nodes have been simulated
  *   fout: FILE into which the output should be written
  * @returns:
  *   none
  */
-extern void node_stats(FILE *fout);
+extern void process_summary(sim_t *sim, FILE *fout);
+
+/* Outputs the peak memory use of each node's arena
+ * @params:
+ *   sim: simulation
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void process_report(sim_t *sim, FILE *fout);
+
+/* Outputs the hot path counters of each node as JSON
+ * @params:
+ *   sim: simulation
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   1 on success, 0 if the counters were compiled out
+ */
+extern int process_metrics(sim_t *sim, FILE *fout);
+
+/* Frees all the memory of the simulation: the nodes, their queues, trace buffers and finished lists
+ * @params:
+ *   sim: simulation
+ * @returns:
+ *   none
+ */
+extern void process_free(sim_t *sim);
 
 #endif //PROSIM_PROCESS_H
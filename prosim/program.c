@@ -0,0 +1,204 @@
+//
+// Compiled programs, interned so that identical programs are shared by all their processes.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "context.h"
+#include "program.h"
+#include "arena.h"
+
+/* The program table is a chained hash table that doubles when it gets too full
+ */
+static program **table;
+static int table_size;
+static int table_count;
+
+/* Programs and their code are allocated from this arena
+ */
+static arena_t program_arena;
+
+// Mutex lock to allow programs to be interned by several parser threads.
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a hash of the packed primitives
+ * @params:
+ *   code: packed primitives
+ *   size: number of primitives
+ * @returns:
+ *   hash value
+ */
+static unsigned int hash_code(const bytecode *code, int size) {
+    unsigned int h = 2166136261u;
+    const unsigned char *bytes = (const unsigned char *) code;
+    for (size_t i = 0; i < size * sizeof(bytecode); i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* Doubles the number of buckets in the program table
+ * @params:
+ *   none
+ * @returns:
+ *   none
+ */
+static void table_grow() {
+    int new_size = table_size ? 2 * table_size : 256;
+    program **new_table = calloc(new_size, sizeof(program *));
+    assert(new_table);
+
+    for (int i = 0; i < table_size; i++) {
+        while (table[i]) {
+            program *prog = table[i];
+            table[i] = prog->next;
+            prog->next = new_table[prog->hash & (new_size - 1)];
+            new_table[prog->hash & (new_size - 1)] = prog;
+        }
+    }
+    free(table);
+    table = new_table;
+    table_size = new_size;
+}
+
+/* Reports a malformed program and frees the buffers used to compile it
+ * @params:
+ *   code: packed primitives
+ *   loops: stack of open LOOPs
+ *   what: what is wrong with the program
+ *   line: line of the offending primitive, counting from 1
+ *   name: program name
+ * @returns:
+ *   NULL
+ */
+static program *malformed(bytecode *code, int *loops, const char *what, int line, const char *name) {
+    fprintf(stderr, "Bad input: %s on line %d in %s\n", what, line, name);
+    free(code);
+    free(loops);
+    return NULL;
+}
+
+/* Compiles a program and interns it, returning the existing copy if an identical program has
+ * already been compiled.  Matches ENDs with their LOOPs and computes the loop nesting depth.
+ * Rejects programs that are empty, do not end with HALT, leave a LOOP open, repeat a LOOP fewer
+ * than once, DOOP for less than a tick, or BLOCK for a negative time, since any of these would
+ * run off the end of the code or never finish.  Safe to call from several threads.
+ * @params:
+ *   ops: array of primitives
+ *   size: number of primitives
+ *   name: program name, for error messages
+ * @returns:
+ *   pointer to the shared program or NULL if the program is malformed
+ */
+extern program *program_intern(const opcode *ops, int size, const char *name) {
+    if (size < 1) {
+        fprintf(stderr, "Bad input: no operations in %s\n", name);
+        return NULL;
+    }
+    bytecode *code = malloc(size * sizeof(bytecode));
+    int *loops = malloc(size * sizeof(int));
+    assert(code && loops);
+
+    /* Pack the primitives, using a stack of open LOOPs to point each END at its LOOP
+     */
+    int depth = 0, max_depth = 0;
+    for (int i = 0; i < size; i++) {
+        int arg = ops[i].arg;
+        if (arg > BC_ARG_MAX || arg < -BC_ARG_MAX) {
+            return malformed(code, loops, "argument to op is too large", i + 1, name);
+        }
+
+        if (ops[i].op == OP_LOOP) {
+            if (arg < 1) {
+                return malformed(code, loops, "LOOP count must be at least 1", i + 1, name);
+            }
+            loops[depth++] = i;
+            if (depth > max_depth) {
+                max_depth = depth;
+            }
+        } else if (ops[i].op == OP_END) {
+            if (depth == 0) {
+                return malformed(code, loops, "END without LOOP", i + 1, name);
+            }
+            arg = loops[--depth];
+        } else if (ops[i].op == OP_DOOP) {
+            if (arg < 1) {
+                return malformed(code, loops, "DOOP time must be at least 1", i + 1, name);
+            }
+        } else if (ops[i].op == OP_BLOCK) {
+            if (arg < 0) {
+                return malformed(code, loops, "BLOCK time must not be negative", i + 1, name);
+            }
+        } else {
+            arg = 0;
+        }
+        code[i] = BC_MAKE(ops[i].op, arg);
+    }
+    if (depth > 0) {
+        return malformed(code, loops, "LOOP without END", loops[depth - 1] + 1, name);
+    }
+    if (ops[size - 1].op != OP_HALT) {
+        return malformed(code, loops, "last operation is not HALT", size, name);
+    }
+    free(loops);
+
+    /* Look for an identical program before adding this one to the table
+     */
+    unsigned int hash = hash_code(code, size);
+    pthread_mutex_lock(&table_mutex);
+    if (table_count >= table_size) {
+        table_grow();
+    }
+
+    program *prog;
+    for (prog = table[hash & (table_size - 1)]; prog; prog = prog->next) {
+        if (prog->hash == hash && prog->size == size && !memcmp(prog->code, code, size * sizeof(bytecode))) {
+            break;
+        }
+    }
+
+    if (!prog) {
+        prog = arena_alloc(&program_arena, sizeof(program));
+        prog->code = arena_alloc(&program_arena, size * sizeof(bytecode));
+        memcpy(prog->code, code, size * sizeof(bytecode));
+        prog->size = size;
+        prog->max_depth = max_depth;
+        prog->hash = hash;
+        prog->next = table[hash & (table_size - 1)];
+        table[hash & (table_size - 1)] = prog;
+        table_count++;
+    }
+    pthread_mutex_unlock(&table_mutex);
+    free(code);
+    return prog;
+}
+
+/* Frees every program, and the program table, at the end of a run
+ * @params:
+ *   none
+ * @returns:
+ *   none
+ */
+extern void program_free_all() {
+    pthread_mutex_lock(&table_mutex);
+    arena_free_all(&program_arena);
+    free(table);
+    table = NULL;
+    table_size = 0;
+    table_count = 0;
+    pthread_mutex_unlock(&table_mutex);
+}
+
+/* Outputs the peak memory use of the program table
+ * @params:
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void program_report(FILE *fout) {
+    pthread_mutex_lock(&table_mutex);
+    arena_report(&program_arena, "programs", fout);
+    pthread_mutex_unlock(&table_mutex);
+}
@@ -0,0 +1,63 @@
+//
+// Compiled programs, interned so that identical programs are shared by all their processes.
+//
+
+#ifndef PROSIM_PROGRAM_H
+#define PROSIM_PROGRAM_H
+
+#include <stdio.h>
+
+/* A primitive is packed into a single int: the op code in the low bits and the argument above it.
+ * For END, the argument is the index of the matching LOOP.
+ */
+typedef int bytecode;
+
+#define BC_OP_BITS 3
+#define BC_OP(bc) ((bc) & ((1 << BC_OP_BITS) - 1))
+#define BC_ARG(bc) ((bc) >> BC_OP_BITS)
+#define BC_MAKE(op, arg) ((int) ((unsigned int) (arg) << BC_OP_BITS) | (op))
+
+/* Largest argument that fits in a packed primitive
+ */
+#define BC_ARG_MAX (0x7fffffff >> BC_OP_BITS)
+
+typedef struct program {
+    bytecode *code;             /* packed primitives, shared read-only by every process running the program */
+    int size;                   /* number of primitives */
+    int max_depth;              /* deepest nesting of LOOPs */
+    unsigned int hash;          /* hash of the primitives, used by the program table */
+    struct program *next;       /* next program in the same hash table bucket */
+} program;
+
+struct opcode;
+
+/* Compiles a program and interns it, returning the existing copy if an identical program has
+ * already been compiled.  Matches ENDs with their LOOPs and computes the loop nesting depth.
+ * Rejects programs that are empty, do not end with HALT, leave a LOOP open, repeat a LOOP fewer
+ * than once, DOOP for less than a tick, or BLOCK for a negative time.  Safe to call from several threads.
+ * @params:
+ *   ops: array of primitives
+ *   size: number of primitives
+ *   name: program name, for error messages
+ * @returns:
+ *   pointer to the shared program or NULL if the program is malformed
+ */
+extern program *program_intern(const struct opcode *ops, int size, const char *name);
+
+/* Frees every program, and the program table, at the end of a run
+ * @params:
+ *   none
+ * @returns:
+ *   none
+ */
+extern void program_free_all();
+
+/* Outputs the peak memory use of the program table
+ * @params:
+ *   fout: FILE into which the output should be written
+ * @returns:
+ *   none
+ */
+extern void program_report(FILE *fout);
+
+#endif //PROSIM_PROGRAM_H
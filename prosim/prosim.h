@@ -0,0 +1,25 @@
+//
+// Public interface of libprosim, the simulation engine behind the prosim command.
+//
+// A program embedding the engine creates a simulation with process_init, sets it up with the process_set_*
+// functions, creates its processes straight from arrays of primitives with process_create, or reads a workload
+// with the loader, and routes them to their nodes with process_submit.  The nodes are then either simulated each
+// on a thread of its own with node_simulate, or stepped on the calling thread with node_run_until and
+// process_run_until, the state transitions going to a sink set with process_set_events instead of the trace.
+// The queue implementation, the trace mode and the program table are shared by every simulation in the program.
+//
+
+#ifndef PROSIM_PROSIM_H
+#define PROSIM_PROSIM_H
+
+#include "arena.h"
+#include "context.h"
+#include "program.h"
+#include "prio_q.h"
+#include "trace.h"
+#include "loader.h"
+#include "pool.h"
+#include "affinity.h"
+#include "process.h"
+
+#endif //PROSIM_PROSIM_H
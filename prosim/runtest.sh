@@ -6,7 +6,7 @@
 # To run a single test, e.g., 13
 #   ./runtest.sh 13
 
-TESTS0="00 01 02 03 04 05 06 07 08 09"
+TESTS0="00 01 02 03 04 05 06 07 08 09 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24"
 TESTS="$TESTS0"
 EXE=prosim
 
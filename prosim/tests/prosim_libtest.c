@@ -0,0 +1,122 @@
+//
+// Drives libprosim the way a program embedding it would, for the golden tests.  The workload on stdin is read
+// with the loader and each node also runs a process made by process_create.  The statistics are streamed, or
+// only their distributions are kept with --quiet, and the release callback hands the loaded processes back to
+// the loader.  A process made by process_create belongs to the simulation and must never reach the callback,
+// the number of those that do is written out after the statistics, along with the number of loaded ones.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include "../prosim.h"
+
+/* The program of the processes made by process_create
+ */
+static const opcode CREATED_OPS[] = {
+    {OP_LOOP, 2}, {OP_DOOP, 2}, {OP_BLOCK, 1}, {OP_END, 0}, {OP_HALT, 0}
+};
+
+/* What the release callback has been handed
+ */
+typedef struct released {
+    loader_t *loader;
+    context **created;      /* the processes made by process_create */
+    int num_created;
+    int loaded;             /* number of loaded processes released */
+    int wrong;              /* number of processes made by process_create released */
+} released_t;
+
+/* Release callback: hand a loaded process back to the loader, and count the processes made by process_create
+ * that should not have been released
+ * @params:
+ *   arg: pointer to the released_t
+ *   proc: process' context
+ * @returns:
+ *   none
+ */
+static void release_process(void *arg, context *proc) {
+    released_t *rel = arg;
+    for (int i = 0; i < rel->num_created; i++) {
+        if (rel->created[i] == proc) {
+            rel->wrong++;
+            return;
+        }
+    }
+    rel->loaded++;
+    loader_release(rel->loader, proc);
+}
+
+int main(int argc, char *argv[]) {
+    int quiet = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quiet")) {
+            quiet = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [--quiet] < workload\n", argv[0]);
+            return -1;
+        }
+    }
+
+    arena_t arena;
+    arena_init(&arena);
+    loader_t *loader = loader_open(stdin, &arena);
+    int num_procs, quantum, num_nodes;
+    if (!loader_header(loader, &num_procs, &quantum, &num_nodes)) {
+        fprintf(stderr, "Bad input, expecting number of processes, quantum size, and number of nodes\n");
+        return -1;
+    }
+
+    sim_t *sim = process_init(quantum, num_nodes);
+    released_t rel = {.loader = loader, .created = malloc(num_nodes * sizeof(context *))};
+    assert(rel.created);
+    if (quiet) {
+        trace_set_mode(TRACE_OFF);
+        process_set_quiet(sim, release_process, &rel);
+    } else {
+        process_set_stream(sim, stdout, release_process, &rel);
+    }
+
+    /* Each node starts with a process made by process_create, followed by the loaded ones
+     */
+    for (int node_id = 1; node_id <= num_nodes; node_id++) {
+        int size = sizeof(CREATED_OPS) / sizeof(CREATED_OPS[0]);
+        context *proc = process_create(sim, "Created", CREATED_OPS, size, 1, node_id, 0);
+        assert(proc);
+        rel.created[rel.num_created++] = proc;
+        process_submit(sim, proc);
+    }
+    for (int i = 0; i < num_procs; i++) {
+        context *proc = loader_next(loader);
+        if (!proc) {
+            fprintf(stderr, "Bad input, could not load program description\n");
+            return -1;
+        }
+        proc->cold->index = num_nodes + i;
+        if (!process_submit(sim, proc)) {
+            fprintf(stderr, "Bad input, could not load program description\n");
+            return -1;
+        }
+    }
+    process_submit_done(sim);
+
+    process_run_until(sim, INT_MAX);
+    if (quiet) {
+        process_distributions(sim, stdout);
+    } else {
+        process_stream(sim, 1);
+        node_stats(sim, stdout);
+    }
+    trace_close();
+    printf("released %d of %d loaded processes and %d of %d created ones\n", rel.loaded, num_procs, rel.wrong,
+           rel.num_created);
+
+    process_free(sim);
+    program_free_all();
+    loader_close(loader);
+    arena_free_all(&arena);
+    free(rel.created);
+    return 0;
+}
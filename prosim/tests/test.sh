@@ -4,7 +4,35 @@ export LC_ALL=C
 echo ======================================================
 echo ====================== TEST $1 =======================
 echo ======================================================
-if timeout 10 ./$2/$3 < tests/test.$1.in > tests/test.$1.raw; then 
+# Extra prosim options, from an ARGS= line of the test's cfg file
+ARGS=$(sed -n 's/^ARGS=//p' tests/test.$1.cfg)
+# A program other than prosim to run, from an EXE= line, such as prosim-libtest
+EXE=$(sed -n 's/^EXE=//p' tests/test.$1.cfg)
+# Resume from the last snapshot of a run checkpointed every CHECKPOINT= ticks, taken of the
+# workload of test SNAPSHOT= if given, or of this test's own workload
+CHECKPOINT=$(sed -n 's/^CHECKPOINT=//p' tests/test.$1.cfg)
+if [ -n "$CHECKPOINT" ]; then
+  SNAPSHOT=$(sed -n 's/^SNAPSHOT=//p' tests/test.$1.cfg)
+  timeout 10 ./$2/${EXE:-$3} $ARGS --checkpoint tests/test.$1.snap --checkpoint-every $CHECKPOINT \
+    < tests/test.${SNAPSHOT:-$1}.in > /dev/null
+  ARGS="$ARGS --resume tests/test.$1.snap"
+fi
+# A test whose cfg has a REJECT line passes if prosim fails with the expected error messages
+if grep "^REJECT" tests/test.$1.cfg > /dev/null; then
+  timeout 10 ./$2/${EXE:-$3} $ARGS < tests/test.$1.in > tests/test.$1.raw 2>&1
+  STATUS=$?
+  rm -f tests/test.$1.snap
+  if [ $STATUS -eq 0 ]; then
+    echo FAILED: the input should have been rejected
+    exit 1
+  elif [ $STATUS -eq 124 ]; then
+    echo TIMEOUT
+    exit 1
+  fi
+  REJECT=1
+fi
+if [ -n "$REJECT" ] || timeout 10 ./$2/${EXE:-$3} $ARGS < tests/test.$1.in > tests/test.$1.raw; then 
+  rm -f tests/test.$1.snap
   cat tests/test.$1.raw | sort > tests/test.$1.out
   if diff -b tests/test.$1.out tests/test.$1.expected > /dev/null; then
     if grep "IS_CONCURRENT" tests/test.$1.cfg > /dev/null; then
@@ -16,7 +44,7 @@ if timeout 10 ./$2/$3 < tests/test.$1.in > tests/test.$1.raw; then
             exit 1
           else 
             echo RETRYING: Output is correct, but no concurrency is apparent
-            timeout 10 ./$2/$3 < tests/test.$1.in > tests/test.$1.raw
+            timeout 10 ./$2/${EXE:-$3} $ARGS < tests/test.$1.in > tests/test.$1.raw
           fi
         else 
           break
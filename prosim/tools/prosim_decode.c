@@ -0,0 +1,256 @@
+//
+// Converts a binary trace written with --binary-trace back to prosim's text trace.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "../trace.h"
+
+/* Largest chunk accepted, anything bigger means the file is corrupt
+ */
+#define CHUNK_MAX (64 * 1024 * 1024)
+
+/* Which events are decoded, -1 or the full clock range when not filtering
+ */
+typedef struct filter {
+    int node;
+    int pid;
+    int from;
+    int to;
+} filter_t;
+
+/* Print the command line options
+ * @params:
+ *   prog: name of the executable
+ * @returns:
+ *   none
+ */
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [options] [trace]\n"
+                    "Writes the binary trace (stdin by default) out as text on stdout.\n"
+                    "  --node N         only the events of node N\n"
+                    "  --pid P          only the events of processes with id P\n"
+                    "  --from T         only the events at or after clock T\n"
+                    "  --to T           only the events at or before clock T\n", prog);
+}
+
+/* Load a 32 bit little endian word
+ * @params:
+ *   in: the word
+ * @returns:
+ *   the word's value
+ */
+static unsigned int get_u32(const unsigned char *in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (unsigned int) in[3] << 24;
+}
+
+/* Load an unsigned LEB128 varint
+ * @params:
+ *   in: pointer to the varint, advanced past it
+ *   end: end of the chunk
+ *   value: where to store the value
+ * @returns:
+ *   1 on success, 0 if the varint runs past the end of the chunk or is too long
+ */
+static int get_varint(const unsigned char **in, const unsigned char *end, unsigned int *value) {
+    unsigned int v = 0;
+    for (int shift = 0; shift < 35 && *in < end; shift += 7) {
+        unsigned char b = *(*in)++;
+        v |= (unsigned int) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *value = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Skip over the records of a chunk, seeking when the input allows it
+ * @params:
+ *   fin: binary trace
+ *   bytes: size of the records
+ *   scratch: buffer of at least bytes bytes for inputs that cannot seek
+ * @returns:
+ *   1 on success, 0 if the trace ends early
+ */
+static int skip_chunk(FILE *fin, size_t bytes, unsigned char *scratch) {
+    if (fseek(fin, (long) bytes, SEEK_CUR) == 0) {
+        return 1;
+    }
+    return fread(scratch, 1, bytes, fin) == bytes;
+}
+
+/* Decode the records of a chunk, appending the ones passing the filter to the output
+ * @params:
+ *   out: text trace buffer
+ *   filt: which events to keep
+ *   flags: TRACE_FLAG_* of the trace
+ *   node: node of the chunk
+ *   count: number of records
+ *   clock: clock of the first record
+ *   in: the records
+ *   end: end of the records
+ * @returns:
+ *   1 on success, 0 if the records are corrupt
+ */
+static int decode_chunk(trace_buf_t *out, filter_t *filt, int flags, int node, unsigned int count,
+                        unsigned int clock, const unsigned char *in, const unsigned char *end) {
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int pid;
+        unsigned int state;
+        unsigned int cpu;
+        int rec_node = node;
+
+        if (flags & TRACE_FLAG_DELTA) {
+            unsigned int delta;
+            if (!get_varint(&in, end, &delta) || !get_varint(&in, end, &pid) || !get_varint(&in, end, &state)) {
+                return 0;
+            }
+            clock += delta;
+            cpu = state >> TRACE_CPU_SHIFT;
+            if (state & TRACE_NODE_FLAG) {
+                unsigned int other;
+                if (!get_varint(&in, end, &other)) {
+                    return 0;
+                }
+                rec_node = (int) other;
+            }
+            state &= TRACE_NODE_FLAG - 1;
+        } else {
+            if (end - in < TRACE_RECORD_SIZE) {
+                return 0;
+            }
+            clock = get_u32(in);
+            pid = get_u32(in + 4);
+            rec_node = in[8] | in[9] << 8;
+            state = in[10];
+            cpu = in[11];
+            in += TRACE_RECORD_SIZE;
+        }
+        if (state >= PROC_STATES) {
+            return 0;
+        }
+
+        if ((filt->node < 0 || rec_node == filt->node) && (filt->pid < 0 || (int) pid == filt->pid) &&
+            (int) clock >= filt->from && (int) clock <= filt->to) {
+            trace_event(out, rec_node, (int) clock, (int) pid, (int) state, (int) cpu);
+        }
+    }
+    return in == end;
+}
+
+/* Decode a binary trace
+ * @params:
+ *   fin: binary trace
+ *   filt: which events to keep
+ * @returns:
+ *   1 on success, 0 if the trace is not a binary trace or is corrupt
+ */
+static int decode(FILE *fin, filter_t *filt) {
+    unsigned char header[TRACE_CHUNK_HEADER];
+    unsigned char *records = NULL;
+    size_t records_cap = 0;
+    trace_buf_t out;
+    int ok = 1;
+
+    if (fread(header, 1, TRACE_FILE_HEADER, fin) != TRACE_FILE_HEADER || memcmp(header, TRACE_MAGIC, 8)) {
+        return 0;
+    }
+    int flags = (int) get_u32(header + 8);
+
+    trace_init(&out);
+    trace_start(&out, NULL);
+    for (;;) {
+        size_t n = fread(header, 1, TRACE_CHUNK_HEADER, fin);
+        if (n == 0) {
+            break;
+        } else if (n != TRACE_CHUNK_HEADER) {
+            ok = 0;
+            break;
+        }
+
+        int node = (int) get_u32(header);
+        unsigned int count = get_u32(header + 4);
+        size_t bytes = get_u32(header + 8);
+        int first_clock = (int) get_u32(header + 12);
+        int last_clock = (int) get_u32(header + 16);
+        int min_pid = (int) get_u32(header + 20);
+        int max_pid = (int) get_u32(header + 24);
+        int min_node = (int) (get_u32(header + 28) & 0xffff);
+        int max_node = (int) (get_u32(header + 28) >> 16);
+        if (bytes > CHUNK_MAX) {
+            ok = 0;
+            break;
+        }
+        if (bytes > records_cap) {
+            records_cap = bytes;
+            records = realloc(records, records_cap);
+            if (!records) {
+                ok = 0;
+                break;
+            }
+        }
+
+        /* Use the chunk header to leave out whole chunks without decoding their records
+         */
+        if ((filt->node >= 0 && (filt->node < min_node || filt->node > max_node)) ||
+            (filt->pid >= 0 && (filt->pid < min_pid || filt->pid > max_pid)) ||
+            last_clock < filt->from || first_clock > filt->to) {
+            if (!skip_chunk(fin, bytes, records)) {
+                ok = 0;
+                break;
+            }
+            continue;
+        }
+
+        if (fread(records, 1, bytes, fin) != bytes ||
+            !decode_chunk(&out, filt, flags, node, count, (unsigned int) first_clock, records, records + bytes)) {
+            ok = 0;
+            break;
+        }
+    }
+    trace_finish(&out);
+    free(out.data);
+    free(records);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    filter_t filt = {-1, -1, INT_MIN, INT_MAX};
+    char *path = NULL;
+
+    /* Process the command line options
+     */
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--node") && i + 1 < argc) {
+            filt.node = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--pid") && i + 1 < argc) {
+            filt.pid = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--from") && i + 1 < argc) {
+            filt.from = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--to") && i + 1 < argc) {
+            filt.to = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return -1;
+        }
+    }
+
+    FILE *fin = stdin;
+    if (path && !(fin = fopen(path, "rb"))) {
+        perror(path);
+        return -1;
+    }
+    if (!decode(fin, &filt)) {
+        fprintf(stderr, "Bad input, not a binary trace or the trace is corrupt\n");
+        return -1;
+    }
+    if (fin != stdin) {
+        fclose(fin);
+    }
+    return 0;
+}
@@ -0,0 +1,269 @@
+//
+// Generates synthetic prosim workloads.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* How the argument of a DOOP, BLOCK or LOOP is drawn
+ */
+enum {
+    DIST_CONST = 0,     /* always lo */
+    DIST_UNIFORM,       /* uniform in [lo, hi] */
+    DIST_EXP            /* exponential with mean lo, rounded up to at least 1 */
+};
+
+typedef struct dist {
+    int kind;
+    int lo;
+    int hi;
+} dist_t;
+
+/* Shape of the generated workload
+ */
+typedef struct gen_config {
+    int nodes;          /* number of nodes */
+    int procs;          /* processes per node, on average */
+    int quantum;        /* CPU quantum */
+    int priorities;     /* priorities are drawn from 0 .. priorities - 1 */
+    int ops;            /* top level operations per program, and per loop body, at most */
+    int depth;          /* deepest loop nesting */
+    double loop_prob;   /* probability that an operation is a loop, while depth allows */
+    double block_prob;  /* probability that a non-loop operation is a BLOCK */
+    dist_t doop;        /* DOOP lengths */
+    dist_t block;       /* BLOCK lengths */
+    dist_t loops;       /* LOOP iteration counts */
+    double skew;        /* Zipf exponent of the share of processes per node, 0 for even */
+    int arrival;        /* mean gap between arrivals on a node, 0 for no arrival times */
+} gen_config_t;
+
+/* Print the command line options
+ * @params:
+ *   prog: name of the executable
+ * @returns:
+ *   none
+ */
+static void usage(char *prog) {
+    fprintf(stderr, "Usage: %s [options] > workload\n"
+                    "  --nodes N        number of nodes (default 4)\n"
+                    "  --procs N        processes per node on average (default 16)\n"
+                    "  --quantum N      CPU quantum (default 5)\n"
+                    "  --priorities N   draw priorities from 0 .. N-1 (default 4)\n"
+                    "  --ops N          at most N operations per program and per loop body (default 4)\n"
+                    "  --depth N        deepest loop nesting (default 2)\n"
+                    "  --loop-prob P    probability that an operation is a loop (default 0.25)\n"
+                    "  --block-prob P   probability that any other operation is a BLOCK (default 0.4)\n"
+                    "  --doop DIST      DOOP lengths (default uniform:1:30)\n"
+                    "  --block DIST     BLOCK lengths (default exp:20)\n"
+                    "  --loops DIST     LOOP iteration counts (default uniform:1:4)\n"
+                    "  --skew S         Zipf exponent of the share of processes per node (default 0, even)\n"
+                    "  --arrival N      mean gap between arrivals on a node (default 0, all arrive at 0)\n"
+                    "  --seed N         random seed (default 1)\n"
+                    "DIST is N, uniform:LO:HI or exp:MEAN\n", prog);
+}
+
+/* Small xorshift generator so that a seed always produces the same workload
+ */
+static unsigned long long rng_state = 88172645463325252ull;
+
+static unsigned long long rng_next() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/* Uniform double in [0, 1)
+ */
+static double rng_unit() {
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Uniform integer in [lo, hi]
+ */
+static int rng_range(int lo, int hi) {
+    return lo + (int) (rng_next() % (unsigned long long) (hi - lo + 1));
+}
+
+/* Parse a distribution given on the command line
+ * @params:
+ *   spec: N, uniform:LO:HI or exp:MEAN
+ *   d: where to store the distribution
+ * @returns:
+ *   1 on success, 0 if spec is not a valid distribution
+ */
+static int parse_dist(const char *spec, dist_t *d) {
+    char extra;
+    if (sscanf(spec, "uniform:%d:%d%c", &d->lo, &d->hi, &extra) == 2) {
+        d->kind = DIST_UNIFORM;
+        return d->lo >= 0 && d->hi >= d->lo;
+    } else if (sscanf(spec, "exp:%d%c", &d->lo, &extra) == 1) {
+        d->kind = DIST_EXP;
+        return d->lo > 0;
+    } else if (sscanf(spec, "%d%c", &d->lo, &extra) == 1) {
+        d->kind = DIST_CONST;
+        return d->lo >= 0;
+    }
+    return 0;
+}
+
+/* Draw from a distribution
+ * @params:
+ *   d: distribution
+ * @returns:
+ *   the value drawn
+ */
+static int draw(dist_t *d) {
+    switch (d->kind) {
+        case DIST_UNIFORM:
+            return rng_range(d->lo, d->hi);
+        case DIST_EXP: {
+            double v = ceil(-log(1.0 - rng_unit()) * d->lo);
+            return v < 1 ? 1 : v > 1e9 ? 1000000000 : (int) v;
+        }
+        default:
+            return d->lo;
+    }
+}
+
+/* Generate the body of a program or loop, not counting its HALT or END
+ * @params:
+ *   cfg: workload shape
+ *   depth: loop nesting of the body
+ *   out: where to write the operations
+ *   len: number of lines written so far, incremented for each line written
+ * @returns:
+ *   none
+ */
+static void gen_body(gen_config_t *cfg, int depth, char *out, int *len) {
+    int n = rng_range(1, cfg->ops);
+
+    for (int i = 0; i < n; i++) {
+        char *line = out + strlen(out);
+        if (depth < cfg->depth && rng_unit() < cfg->loop_prob) {
+            sprintf(line, "LOOP %d\n", draw(&cfg->loops));
+            (*len)++;
+            gen_body(cfg, depth + 1, out, len);
+            strcat(out, "END\n");
+        } else if (rng_unit() < cfg->block_prob) {
+            sprintf(line, "BLOCK %d\n", draw(&cfg->block));
+        } else {
+            sprintf(line, "DOOP %d\n", draw(&cfg->doop));
+        }
+        (*len)++;
+    }
+}
+
+/* Bound on the length of a generated program body, in lines
+ * @params:
+ *   cfg: workload shape
+ *   depth: loop nesting of the body
+ * @returns:
+ *   the most lines gen_body can produce
+ */
+static double body_lines(gen_config_t *cfg, int depth) {
+    double inner = depth < cfg->depth ? body_lines(cfg, depth + 1) + 2 : 1;
+    return cfg->ops * inner;
+}
+
+int main(int argc, char *argv[]) {
+    gen_config_t cfg = {4, 16, 5, 4, 4, 2, 0.25, 0.4,
+                        {DIST_UNIFORM, 1, 30}, {DIST_EXP, 20, 0}, {DIST_UNIFORM, 1, 4}, 0, 0};
+    int ok = 1;
+
+    /* Process the command line options
+     */
+    for (int i = 1; i < argc && ok; i++) {
+        char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) {
+            ok = 0;
+        } else if (!strcmp(argv[i], "--nodes")) {
+            ok = (cfg.nodes = atoi(val)) > 0;
+        } else if (!strcmp(argv[i], "--procs")) {
+            ok = (cfg.procs = atoi(val)) > 0;
+        } else if (!strcmp(argv[i], "--quantum")) {
+            ok = (cfg.quantum = atoi(val)) > 0;
+        } else if (!strcmp(argv[i], "--priorities")) {
+            ok = (cfg.priorities = atoi(val)) > 0;
+        } else if (!strcmp(argv[i], "--ops")) {
+            ok = (cfg.ops = atoi(val)) > 0;
+        } else if (!strcmp(argv[i], "--depth")) {
+            ok = (cfg.depth = atoi(val)) >= 0;
+        } else if (!strcmp(argv[i], "--loop-prob")) {
+            cfg.loop_prob = atof(val);
+        } else if (!strcmp(argv[i], "--block-prob")) {
+            cfg.block_prob = atof(val);
+        } else if (!strcmp(argv[i], "--doop")) {
+            ok = parse_dist(val, &cfg.doop);
+        } else if (!strcmp(argv[i], "--block")) {
+            ok = parse_dist(val, &cfg.block);
+        } else if (!strcmp(argv[i], "--loops")) {
+            ok = parse_dist(val, &cfg.loops);
+        } else if (!strcmp(argv[i], "--skew")) {
+            ok = (cfg.skew = atof(val)) >= 0;
+        } else if (!strcmp(argv[i], "--arrival")) {
+            ok = (cfg.arrival = atoi(val)) >= 0;
+        } else if (!strcmp(argv[i], "--seed")) {
+            rng_state = strtoull(val, NULL, 0) * 2654435761ull + 1;
+        } else {
+            ok = 0;
+        }
+        i++;
+    }
+    if (!ok) {
+        usage(argv[0]);
+        return -1;
+    }
+
+    /* Cumulative share of the processes of each node, node i gets a share proportional to 1 / i^skew
+     */
+    double *cdf = malloc(cfg.nodes * sizeof(double));
+    double total = 0;
+    for (int n = 0; n < cfg.nodes; n++) {
+        total += pow(n + 1, -cfg.skew);
+        cdf[n] = total;
+    }
+
+    int *last_arrival = calloc(cfg.nodes, sizeof(int));
+    size_t body_max = (size_t) body_lines(&cfg, 0) * 24 + 1;
+    char *body = malloc(body_max);
+    if (!cdf || !last_arrival || !body) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    long long num_procs = (long long) cfg.nodes * cfg.procs;
+    printf("%lld %d %d\n", num_procs, cfg.quantum, cfg.nodes);
+    for (long long i = 0; i < num_procs; i++) {
+        /* Pick the node by binary search over the cumulative shares
+         */
+        double u = rng_unit() * total;
+        int lo = 0, hi = cfg.nodes - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] > u) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+
+        int len = 1;
+        body[0] = '\0';
+        gen_body(&cfg, 0, body, &len);
+
+        printf("P%lld %d %d %d", i + 1, len, rng_range(0, cfg.priorities - 1), lo + 1);
+        if (cfg.arrival) {
+            last_arrival[lo] += (int) (-log(1.0 - rng_unit()) * cfg.arrival);
+            printf(" %d", last_arrival[lo]);
+        }
+        printf("\n%sHALT\n\n", body);
+    }
+
+    free(cdf);
+    free(last_arrival);
+    free(body);
+    return 0;
+}
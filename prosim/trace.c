@@ -0,0 +1,474 @@
+//
+// Per-node buffered output of process state transitions.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "trace.h"
+
+/* Longest line produced by trace_event: brackets, four 10 digit numbers, separators and a state name
+ */
+#define TRACE_LINE_MAX 80
+
+static const char *state_names[PROC_STATES] = {"new", "ready", "running", "blocked", "finished",
+                                                    "migrating"};
+
+static int trace_mode = TRACE_INTERLEAVED;
+static int trace_fd = STDOUT_FILENO;    /* where the trace is written */
+static int trace_binary = 0;            /* the trace is written in the binary format */
+static int trace_flags = 0;             /* TRACE_FLAG_* of the binary trace */
+
+// Mutex lock to keep chunks from different nodes from being interleaved in the output.
+static pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Select how the per-node streams are combined, must be called before any output is traced
+ * @params:
+ *   mode: TRACE_INTERLEAVED (default), TRACE_ORDERED or TRACE_OFF
+ * @returns:
+ *   none
+ */
+extern void trace_set_mode(int mode) {
+    trace_mode = mode;
+}
+
+/* Write all of the iovecs to a file descriptor, retrying after partial writes
+ * @params:
+ *   fd: file descriptor to write to
+ *   iov: array of buffers, modified as the buffers are written
+ *   cnt: number of buffers
+ * @returns:
+ *   none
+ */
+static void writev_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("trace output");
+            exit(-1);
+        }
+
+        /* Skip the buffers that have been completely written and trim the partial one
+         */
+        while (cnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/* Store a 32 bit little endian word
+ * @params:
+ *   out: where to store the word
+ *   value: word to store
+ * @returns:
+ *   pointer just past the word
+ */
+static unsigned char *put_u32(unsigned char *out, unsigned int value) {
+    out[0] = (unsigned char) value;
+    out[1] = (unsigned char) (value >> 8);
+    out[2] = (unsigned char) (value >> 16);
+    out[3] = (unsigned char) (value >> 24);
+    return out + 4;
+}
+
+/* Store an unsigned LEB128 varint, at most 5 bytes
+ * @params:
+ *   out: where to store the varint
+ *   value: value to store
+ * @returns:
+ *   pointer just past the varint
+ */
+static unsigned char *put_varint(unsigned char *out, unsigned int value) {
+    while (value >= 0x80) {
+        *out++ = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (unsigned char) value;
+    return out;
+}
+
+/* Write the trace in the binary format to a file instead of as text on stdout, must be called
+ * before any output is traced
+ * @params:
+ *   path: name of the file to create
+ *   flags: 0 for plain records, TRACE_FLAG_DELTA for delta encoded records
+ * @returns:
+ *   1 on success, 0 if the file cannot be created
+ */
+extern int trace_open_binary(const char *path, int flags) {
+    unsigned char header[TRACE_FILE_HEADER];
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+
+    memcpy(header, TRACE_MAGIC, 8);
+    put_u32(put_u32(header + 8, flags), 0);
+    struct iovec iov = {header, sizeof(header)};
+    writev_all(fd, &iov, 1);
+
+    trace_fd = fd;
+    trace_binary = 1;
+    trace_flags = flags;
+    return 1;
+}
+
+/* Close the binary trace file, if any, once all the output has been flushed
+ * @params:
+ *   none
+ * @returns:
+ *   none
+ */
+extern void trace_close() {
+    if (trace_binary) {
+        close(trace_fd);
+        trace_fd = STDOUT_FILENO;
+        trace_binary = 0;
+    }
+}
+
+/* Empty a trace buffer, in the binary format the buffer starts with room for the chunk header
+ * @params:
+ *   buf: trace buffer to empty
+ * @returns:
+ *   none
+ */
+static void trace_reset(trace_buf_t *buf) {
+    buf->len = trace_binary ? TRACE_CHUNK_HEADER : 0;
+    buf->count = 0;
+}
+
+/* Fill in the chunk header at the start of a buffer holding binary records
+ * @params:
+ *   buf: node's trace buffer
+ * @returns:
+ *   none
+ */
+static void trace_seal(trace_buf_t *buf) {
+    unsigned char *out = (unsigned char *) buf->data;
+    out = put_u32(out, buf->node);
+    out = put_u32(out, buf->count);
+    out = put_u32(out, buf->len - TRACE_CHUNK_HEADER);
+    out = put_u32(out, buf->first_clock);
+    out = put_u32(out, buf->last_clock);
+    out = put_u32(out, buf->min_pid);
+    out = put_u32(out, buf->max_pid);
+    put_u32(out, (unsigned int) buf->min_node | (unsigned int) buf->max_node << 16);
+}
+
+/* Initialize an empty trace buffer, which gets its memory from trace_start
+ * @params:
+ *   buf: trace buffer to initialize
+ * @returns:
+ *   none
+ */
+extern void trace_init(trace_buf_t *buf) {
+    buf->data = NULL;
+    buf->spill_fd = -1;
+    buf->sink = NULL;
+    trace_reset(buf);
+}
+
+/* Give a trace buffer its memory, unless it has some or nothing is to be traced, before any event is traced into
+ * it.  Called from the thread that fills the buffer, so that the memory is first touched, and placed, by that thread.
+ * @params:
+ *   buf: trace buffer
+ *   arena: arena from which to allocate the buffer
+ * @returns:
+ *   none
+ */
+extern void trace_start(trace_buf_t *buf, arena_t *arena) {
+    if (!buf->data && (buf->sink || trace_mode != TRACE_OFF)) {
+        buf->data = arena_alloc(arena, TRACE_BUF_SIZE);
+    }
+}
+
+/* Hand the events of a buffer to a sink instead of writing them out, whatever the mode, must be called before
+ * trace_start
+ * @params:
+ *   buf: trace buffer
+ *   sink: receives the events, from the thread tracing them, whenever the buffer fills up or is finished
+ *   arg: argument of sink
+ * @returns:
+ *   none
+ */
+extern void trace_set_sink(trace_buf_t *buf, trace_sink_t sink, void *arg) {
+    buf->sink = sink;
+    buf->sink_arg = arg;
+    buf->len = 0;
+    buf->count = 0;
+}
+
+/* Hand the entries in a buffer to its sink and empty it
+ * @params:
+ *   buf: trace buffer with a sink
+ * @returns:
+ *   none
+ */
+static void trace_deliver(trace_buf_t *buf) {
+    if (buf->count > 0) {
+        buf->sink(buf->sink_arg, (const trace_entry_t *) buf->data, buf->count);
+        buf->count = 0;
+    }
+}
+
+/* Write the buffered output, or to the spill file if the streams are being held back
+ * @params:
+ *   buf: node's trace buffer
+ * @returns:
+ *   none
+ */
+static void trace_write(trace_buf_t *buf) {
+    struct iovec iov = {buf->data, buf->len};
+
+    if (trace_binary) {
+        trace_seal(buf);
+    }
+    if (trace_mode == TRACE_ORDERED) {
+        if (buf->spill_fd < 0) {
+            FILE *spill = tmpfile();
+            assert(spill);
+            buf->spill_fd = dup(fileno(spill));
+            fclose(spill);
+        }
+        writev_all(buf->spill_fd, &iov, 1);
+    } else {
+        pthread_mutex_lock(&stdout_mutex);
+        writev_all(trace_fd, &iov, 1);
+        pthread_mutex_unlock(&stdout_mutex);
+    }
+    trace_reset(buf);
+}
+
+/* Format a non-negative integer into a buffer, zero padded to at least width digits
+ * @params:
+ *   out: where to write the digits
+ *   value: integer to format
+ *   width: minimum number of digits
+ * @returns:
+ *   pointer just past the last digit
+ */
+static char *put_int(char *out, int value, int width) {
+    char digits[12];
+    int n = 0;
+    unsigned int v = value < 0 ? 0u - (unsigned int) value : (unsigned int) value;
+
+    do {
+        digits[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n < width) {
+        digits[n++] = '0';
+    }
+    if (value < 0) {
+        *out++ = '-';
+    }
+    while (n) {
+        *out++ = digits[--n];
+    }
+    return out;
+}
+
+/* Append a binary record to the buffer, keeping track of what goes in the chunk header
+ * @params:
+ *   buf: node's trace buffer, with room for a record
+ *   node: node id
+ *   clock: node clock at which the transition happens
+ *   pid: process id
+ *   state: new state, one of PROC_*
+ *   cpu: CPU of the process, or 0
+ * @returns:
+ *   none
+ */
+static void trace_record(trace_buf_t *buf, int node, int clock, int pid, int state, int cpu) {
+    unsigned char *out = (unsigned char *) buf->data + buf->len;
+
+    if (buf->count == 0) {
+        buf->node = buf->min_node = buf->max_node = node;
+        buf->first_clock = buf->last_clock = clock;
+        buf->min_pid = buf->max_pid = pid;
+    }
+
+    if (trace_flags & TRACE_FLAG_DELTA) {
+        out = put_varint(out, (unsigned int) clock - (unsigned int) buf->last_clock);
+        out = put_varint(out, pid);
+        out = put_varint(out, state | (node != buf->node ? TRACE_NODE_FLAG : 0) | cpu << TRACE_CPU_SHIFT);
+        if (node != buf->node) {
+            out = put_varint(out, node);
+        }
+    } else {
+        out = put_u32(out, clock);
+        out = put_u32(out, pid);
+        *out++ = (unsigned char) node;
+        *out++ = (unsigned char) (node >> 8);
+        *out++ = (unsigned char) state;
+        *out++ = (unsigned char) cpu;
+    }
+    buf->len = (char *) out - buf->data;
+
+    buf->count++;
+    buf->last_clock = clock;
+    if (pid < buf->min_pid) {
+        buf->min_pid = pid;
+    }
+    if (pid > buf->max_pid) {
+        buf->max_pid = pid;
+    }
+    if (node < buf->min_node) {
+        buf->min_node = node;
+    }
+    if (node > buf->max_node) {
+        buf->max_node = node;
+    }
+}
+
+/* Append a "[NN] TTTTT: process P state" line, followed by " on cpu C" if a CPU is given,
+ * a binary record, or an entry for the sink, to the buffer, writing the buffer out if it is full
+ * @params:
+ *   buf: node's trace buffer
+ *   node: node id
+ *   clock: node clock at which the transition happens
+ *   pid: process id
+ *   state: new state, one of PROC_*
+ *   cpu: CPU of the process, from 1, or 0 to leave it out
+ * @returns:
+ *   none
+ */
+extern void trace_event(trace_buf_t *buf, int node, int clock, int pid, int state, int cpu) {
+    if (buf->sink) {
+        if (buf->count == TRACE_BUF_SIZE / sizeof(trace_entry_t)) {
+            trace_deliver(buf);
+        }
+        trace_entry_t *entry = (trace_entry_t *) buf->data + buf->count++;
+        entry->node = node;
+        entry->clock = clock;
+        entry->pid = pid;
+        entry->state = state;
+        entry->cpu = cpu;
+        return;
+    }
+    if (trace_mode == TRACE_OFF) {
+        return;
+    }
+    if (buf->len + TRACE_LINE_MAX > TRACE_BUF_SIZE) {
+        trace_write(buf);
+    }
+
+    if (trace_binary) {
+        trace_record(buf, node, clock, pid, state, cpu);
+        return;
+    }
+
+    /* Same format as printf("[%02d] %5.5d: process %d %s\n", ...)
+     */
+    const char *name = state_names[state];
+    char *out = buf->data + buf->len;
+    *out++ = '[';
+    out = put_int(out, node, 2);
+    memcpy(out, "] ", 2);
+    out = put_int(out + 2, clock, 5);
+    memcpy(out, ": process ", 10);
+    out = put_int(out + 10, pid, 1);
+    *out++ = ' ';
+    while (*name) {
+        *out++ = *name++;
+    }
+    if (cpu > 0) {
+        memcpy(out, " on cpu ", 8);
+        out = put_int(out + 8, cpu, 1);
+    }
+    *out++ = '\n';
+    buf->len = out - buf->data;
+    buf->count++;
+}
+
+/* Called by a node thread when its simulation is done, or stops for now.  Writes out whatever is left in
+ * the buffer in TRACE_INTERLEAVED mode, or hands it to the sink.
+ * @params:
+ *   buf: node's trace buffer
+ * @returns:
+ *   none
+ */
+extern void trace_finish(trace_buf_t *buf) {
+    if (buf->sink) {
+        trace_deliver(buf);
+    } else if (trace_mode == TRACE_INTERLEAVED && buf->count > 0) {
+        trace_write(buf);
+    }
+}
+
+/* Write out everything held back in the buffer, including any spilled output.
+ * Called for each node in node order after all node threads are done.
+ * @params:
+ *   buf: node's trace buffer
+ * @returns:
+ *   none
+ */
+extern void trace_flush(trace_buf_t *buf) {
+    if (buf->sink) {
+        trace_deliver(buf);
+        return;
+    }
+
+    /* Copy the spilled output first, in large blocks
+     */
+    if (buf->spill_fd >= 0) {
+        static char block[TRACE_BUF_SIZE];
+        ssize_t n;
+
+        lseek(buf->spill_fd, 0, SEEK_SET);
+        while ((n = read(buf->spill_fd, block, sizeof(block))) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("trace output");
+                exit(-1);
+            }
+            struct iovec iov = {block, n};
+            writev_all(trace_fd, &iov, 1);
+        }
+        close(buf->spill_fd);
+        buf->spill_fd = -1;
+    }
+
+    if (buf->count > 0) {
+        struct iovec iov = {buf->data, buf->len};
+        if (trace_binary) {
+            trace_seal(buf);
+        }
+        writev_all(trace_fd, &iov, 1);
+        trace_reset(buf);
+    }
+}
+
+/* Write text out to a stream without it getting mixed up with trace chunks being written at the same time
+ * @params:
+ *   fout: stream to write to, flushed first
+ *   text: text to write
+ *   len: length of the text
+ * @returns:
+ *   none
+ */
+extern void trace_write_text(FILE *fout, const char *text, size_t len) {
+    struct iovec iov = {(void *) text, len};
+    pthread_mutex_lock(&stdout_mutex);
+    fflush(fout);
+    writev_all(fileno(fout), &iov, 1);
+    pthread_mutex_unlock(&stdout_mutex);
+}
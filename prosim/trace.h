@@ -0,0 +1,196 @@
+//
+// Per-node buffered output of process state transitions.
+//
+
+#ifndef PROSIM_TRACE_H
+#define PROSIM_TRACE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "arena.h"
+
+/* How the per-node trace streams are combined on stdout
+ */
+enum {
+    TRACE_INTERLEAVED = 0,  /* each node writes its buffer whenever it fills up */
+    TRACE_ORDERED,          /* streams are held back and written in node order at the end */
+    TRACE_OFF               /* nothing is traced */
+};
+
+/* Process states, as recorded in the trace
+ */
+enum {
+    PROC_NEW = 0,
+    PROC_READY,
+    PROC_RUNNING,
+    PROC_BLOCKED,
+    PROC_FINISHED,
+    PROC_MIGRATING,     /* moving to another node, see process_set_balance */
+    PROC_STATES         /* number of states */
+};
+
+/* Binary trace format.  All integers are little endian.  A binary trace starts with a
+ * TRACE_FILE_HEADER byte header: the magic "PROSIMTR", a 32 bit flags word and 32 zero bits.
+ * It is followed by chunks, one per buffer written out by a node.  Each chunk starts with a
+ * TRACE_CHUNK_HEADER byte header of eight 32 bit words:
+ *   node of the first record, number of records, size of the records in bytes,
+ *   clock of the first record, clock of the last record, lowest pid, highest pid,
+ *   lowest node in the low 16 bits and highest node in the high 16 bits
+ * so a reader can skip the chunks it is not interested in without looking at their records.
+ * A node's chunks normally only hold its own events, but also hold those of the processes
+ * that migrated to it.  Plain records are TRACE_RECORD_SIZE bytes:
+ *   clock (32 bits), pid (32 bits), node (16 bits), state (8 bits), cpu (8 bits)
+ * With TRACE_FLAG_DELTA, a record is three LEB128 varints: the clock minus the clock of the
+ * previous record in the chunk (of the chunk header's first clock for the first record), the pid,
+ * and the state plus the cpu shifted left by TRACE_CPU_SHIFT.  If TRACE_NODE_FLAG is set in the
+ * last one, a fourth varint holds the record's node, otherwise it is the chunk's first node.
+ */
+#define TRACE_MAGIC "PROSIMTR"
+#define TRACE_FILE_HEADER 16
+#define TRACE_CHUNK_HEADER 32
+#define TRACE_RECORD_SIZE 12
+#define TRACE_FLAG_DELTA 1
+#define TRACE_NODE_FLAG 8
+#define TRACE_CPU_SHIFT 4
+
+/* Size of a node's trace buffer, the buffer is written out in chunks of about this size
+ */
+#define TRACE_BUF_SIZE (256 * 1024)
+
+/* A process state transition, as handed to a trace sink
+ */
+typedef struct trace_entry {
+    int node;               /* node id */
+    int clock;              /* node clock at which the transition happens */
+    int pid;                /* process id */
+    int state;              /* new state, one of PROC_* */
+    int cpu;                /* CPU of the process, from 1, or 0 on single CPU nodes */
+} trace_entry_t;
+
+/* Receives a node's state transitions in order, in batches, instead of them being written out
+ * @params:
+ *   arg: argument given with the sink
+ *   entries: the transitions, only valid during the call
+ *   count: number of entries
+ * @returns:
+ *   none
+ */
+typedef void (*trace_sink_t)(void *arg, const trace_entry_t *entries, int count);
+
+/* A node's trace buffer.  It is only touched by the thread simulating the node, except
+ * before the node threads start and after they have been joined.
+ */
+typedef struct trace_buf {
+    char *data;             /* buffered output */
+    size_t len;             /* number of bytes in data */
+    int count;              /* number of events in data */
+    int node;               /* node of the first event in data */
+    int min_node;           /* lowest node in data */
+    int max_node;           /* highest node in data */
+    int first_clock;        /* clock of the first event in data */
+    int last_clock;         /* clock of the last event in data */
+    int min_pid;            /* lowest pid in data */
+    int max_pid;            /* highest pid in data */
+    int spill_fd;           /* temporary file holding output that did not fit, TRACE_ORDERED only */
+    trace_sink_t sink;      /* receives the events instead of them being written out, or NULL */
+    void *sink_arg;         /* argument of sink */
+} trace_buf_t;
+
+/* Select how the per-node streams are combined, must be called before any output is traced
+ * @params:
+ *   mode: TRACE_INTERLEAVED (default), TRACE_ORDERED or TRACE_OFF
+ * @returns:
+ *   none
+ */
+extern void trace_set_mode(int mode);
+
+/* Write the trace in the binary format to a file instead of as text on stdout, must be called
+ * before any output is traced
+ * @params:
+ *   path: name of the file to create
+ *   flags: 0 for plain records, TRACE_FLAG_DELTA for delta encoded records
+ * @returns:
+ *   1 on success, 0 if the file cannot be created
+ */
+extern int trace_open_binary(const char *path, int flags);
+
+/* Close the binary trace file, if any, once all the output has been flushed
+ * @params:
+ *   none
+ * @returns:
+ *   none
+ */
+extern void trace_close();
+
+/* Initialize an empty trace buffer, which gets its memory from trace_start
+ * @params:
+ *   buf: trace buffer to initialize
+ * @returns:
+ *   none
+ */
+extern void trace_init(trace_buf_t *buf);
+
+/* Give a trace buffer its memory, unless it has some or nothing is to be traced, before any event is traced into
+ * it.  Called from the thread that fills the buffer, so that the memory is first touched, and placed, by that thread.
+ * @params:
+ *   buf: trace buffer
+ *   arena: arena from which to allocate the buffer
+ * @returns:
+ *   none
+ */
+extern void trace_start(trace_buf_t *buf, arena_t *arena);
+
+/* Hand the events of a buffer to a sink instead of writing them out, whatever the mode, must be called before
+ * trace_start
+ * @params:
+ *   buf: trace buffer
+ *   sink: receives the events, from the thread tracing them, whenever the buffer fills up or is finished
+ *   arg: argument of sink
+ * @returns:
+ *   none
+ */
+extern void trace_set_sink(trace_buf_t *buf, trace_sink_t sink, void *arg);
+
+/* Append a "[NN] TTTTT: process P state" line, followed by " on cpu C" if a CPU is given,
+ * a binary record, or an entry for the sink, to the buffer, writing the buffer out if it is full
+ * @params:
+ *   buf: node's trace buffer
+ *   node: node id
+ *   clock: node clock at which the transition happens
+ *   pid: process id
+ *   state: new state, one of PROC_*
+ *   cpu: CPU of the process, from 1, or 0 to leave it out
+ * @returns:
+ *   none
+ */
+extern void trace_event(trace_buf_t *buf, int node, int clock, int pid, int state, int cpu);
+
+/* Called by a node thread when its simulation is done, or stops for now.  Writes out whatever is left in
+ * the buffer in TRACE_INTERLEAVED mode, or hands it to the sink.
+ * @params:
+ *   buf: node's trace buffer
+ * @returns:
+ *   none
+ */
+extern void trace_finish(trace_buf_t *buf);
+
+/* Write out everything held back in the buffer, including any spilled output.
+ * Called for each node in node order after all node threads are done.
+ * @params:
+ *   buf: node's trace buffer
+ * @returns:
+ *   none
+ */
+extern void trace_flush(trace_buf_t *buf);
+
+/* Write text out to a stream without it getting mixed up with trace chunks being written at the same time
+ * @params:
+ *   fout: stream to write to, flushed first
+ *   text: text to write
+ *   len: length of the text
+ * @returns:
+ *   none
+ */
+extern void trace_write_text(FILE *fout, const char *text, size_t len);
+
+#endif //PROSIM_TRACE_H
@@ -0,0 +1,196 @@
+//
+// Hierarchical timing wheel holding items until the time at which they are due.
+//
+
+#include <limits.h>
+#include <assert.h>
+#include "wheel.h"
+
+/* Allocates an empty wheel
+ * @params:
+ *   arena: arena from which to allocate the wheel and its entries
+ * @returns:
+ *   pointer to the wheel
+ */
+extern wheel_t *wheel_new_in(arena_t *arena) {
+    wheel_t *w = arena_alloc(arena, sizeof(wheel_t));
+    w->arena = arena;
+    return w;
+}
+
+/* Appends an entry to the slot it belongs in, given the wheel's time
+ * @params:
+ *   w: wheel
+ *   e: entry, due no earlier than the wheel's time
+ * @returns:
+ *   none
+ */
+static void place(wheel_t *w, wheel_entry_t *e) {
+    /* The level is that of the highest bit in which the due time differs from now
+     */
+    unsigned int diff = (unsigned int) (e->when ^ w->now);
+    int level = diff < WHEEL_SLOTS ? 0 : (31 - __builtin_clz(diff)) / WHEEL_BITS;
+    int s = (e->when >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+    wheel_slot_t *slot = &w->slots[level][s];
+
+    e->next = NULL;
+    if (slot->tail) {
+        slot->tail->next = e;
+    } else {
+        slot->head = e;
+    }
+    slot->tail = e;
+    w->used[level] |= 1ull << s;
+}
+
+/* Adds an item to the wheel, after any items due at the same time
+ * @params:
+ *   w: wheel
+ *   item: item to add
+ *   when: time at which the item is due, no earlier than the last item taken out of the wheel
+ * @returns:
+ *   none
+ */
+extern void wheel_add(wheel_t *w, void *item, int when) {
+    assert(when >= w->now);
+
+    wheel_entry_t *e = w->free;
+    if (e) {
+        w->free = e->next;
+    } else {
+        e = arena_alloc(w->arena, sizeof(wheel_entry_t));
+    }
+    e->when = when;
+    e->item = item;
+    place(w, e);
+
+    if (w->min_valid && when < w->min) {
+        w->min = when;
+    }
+    w->count++;
+}
+
+/* Returns the earliest time at which an item is due
+ * @params:
+ *   w: wheel
+ * @returns:
+ *   the time, or INT_MAX if the wheel is empty
+ */
+extern int wheel_next(wheel_t *w) {
+    if (w->count == 0) {
+        return INT_MAX;
+    }
+    if (w->min_valid) {
+        return w->min;
+    }
+
+    /* The first used slot of the lowest used level holds the earliest items, a level 0 slot
+     * only holds items due at the same time, the others have to be searched
+     */
+    int level = 0;
+    while (!w->used[level]) {
+        level++;
+    }
+    int s = __builtin_ctzll(w->used[level]);
+    if (level == 0) {
+        w->min = (w->now & ~(WHEEL_SLOTS - 1)) | s;
+    } else {
+        w->min = INT_MAX;
+        for (wheel_entry_t *e = w->slots[level][s].head; e; e = e->next) {
+            if (e->when < w->min) {
+                w->min = e->when;
+            }
+        }
+    }
+    w->min_valid = 1;
+    return w->min;
+}
+
+/* Moves the wheel's time forward to that of its earliest items, cascading the slots holding
+ * items due in the new time's range down to the lower levels
+ * @params:
+ *   w: wheel
+ *   now: time of the earliest items in the wheel
+ * @returns:
+ *   none
+ */
+static void advance(wheel_t *w, int now) {
+    int old = w->now;
+    w->now = now;
+
+    for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+        int shift = level * WHEEL_BITS;
+        int s = (now >> shift) & (WHEEL_SLOTS - 1);
+        if ((old >> shift) == (now >> shift) || !(w->used[level] & (1ull << s))) {
+            continue;
+        }
+
+        /* Re-placing the entries in order keeps items due at the same time in insertion order
+         */
+        wheel_entry_t *e = w->slots[level][s].head;
+        w->slots[level][s].head = w->slots[level][s].tail = NULL;
+        w->used[level] &= ~(1ull << s);
+        while (e) {
+            wheel_entry_t *next = e->next;
+            place(w, e);
+            e = next;
+        }
+    }
+}
+
+/* Takes out the next item due at or before a time, items due at the same time come out in the
+ * order they were added
+ * @params:
+ *   w: wheel
+ *   clock: current time
+ * @returns:
+ *   the item, or NULL if no item is due
+ */
+extern void *wheel_expire(wheel_t *w, int clock) {
+    int when = wheel_next(w);
+    if (w->count == 0 || when > clock) {
+        return NULL;
+    }
+    if (when != w->now) {
+        advance(w, when);
+    }
+
+    int s = when & (WHEEL_SLOTS - 1);
+    wheel_slot_t *slot = &w->slots[0][s];
+    wheel_entry_t *e = slot->head;
+    slot->head = e->next;
+    if (!slot->head) {
+        slot->tail = NULL;
+        w->used[0] &= ~(1ull << s);
+        w->min_valid = 0;
+    }
+    w->count--;
+
+    void *item = e->item;
+    e->next = w->free;
+    w->free = e;
+    return item;
+}
+
+/* Returns true if the wheel is empty
+ * @params:
+ *   w: wheel
+ * @returns:
+ *   1 if the wheel is empty and 0 otherwise
+ */
+extern int wheel_empty(wheel_t *w) {
+    return w->count == 0;
+}
+
+/* Moves the time of an empty wheel back, so that items due before the last one taken out can be added
+ * @params:
+ *   w: empty wheel
+ *   now: new time of the wheel
+ * @returns:
+ *   none
+ */
+extern void wheel_rewind(wheel_t *w, int now) {
+    assert(w->count == 0);
+    w->now = now;
+    w->min_valid = 0;
+}
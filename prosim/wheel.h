@@ -0,0 +1,96 @@
+//
+// Hierarchical timing wheel holding items until the time at which they are due.
+//
+
+#ifndef PROSIM_WHEEL_H
+#define PROSIM_WHEEL_H
+
+#include "arena.h"
+
+/* Levels of the wheel and slots per level, enough levels to cover every non-negative int
+ */
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 6
+
+typedef struct wheel_entry {
+    struct wheel_entry *next;   /* next entry in the same slot, in insertion order */
+    int when;                   /* time at which the item is due */
+    void *item;
+} wheel_entry_t;
+
+typedef struct wheel_slot {
+    wheel_entry_t *head;
+    wheel_entry_t *tail;
+} wheel_slot_t;
+
+/* Slot s of level 0 holds the items due at the time with the same high bits as now and s as its
+ * lowest WHEEL_BITS bits.  Slot s of level L holds the items whose bits above level L are those of now,
+ * and whose level L bits are s.  Every item is due at or after now, so the slots of each level are in
+ * due order from now's slot on, and a level's items are all due before those of the levels above it.
+ */
+typedef struct wheel {
+    arena_t *arena;             /* arena from which entries are allocated */
+    wheel_entry_t *free;        /* entries that can be reused */
+    int now;                    /* time of the last item taken out of the wheel */
+    int count;                  /* number of items in the wheel */
+    int min;                    /* earliest time at which an item is due, if min_valid */
+    int min_valid;
+    unsigned long long used[WHEEL_LEVELS];  /* bitmap of the non-empty slots of each level */
+    wheel_slot_t slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} wheel_t;
+
+/* Allocates an empty wheel
+ * @params:
+ *   arena: arena from which to allocate the wheel and its entries
+ * @returns:
+ *   pointer to the wheel
+ */
+extern wheel_t *wheel_new_in(arena_t *arena);
+
+/* Adds an item to the wheel, after any items due at the same time
+ * @params:
+ *   w: wheel
+ *   item: item to add
+ *   when: time at which the item is due, no earlier than the last item taken out of the wheel
+ * @returns:
+ *   none
+ */
+extern void wheel_add(wheel_t *w, void *item, int when);
+
+/* Returns the earliest time at which an item is due
+ * @params:
+ *   w: wheel
+ * @returns:
+ *   the time, or INT_MAX if the wheel is empty
+ */
+extern int wheel_next(wheel_t *w);
+
+/* Takes out the next item due at or before a time, items due at the same time come out in the
+ * order they were added
+ * @params:
+ *   w: wheel
+ *   clock: current time
+ * @returns:
+ *   the item, or NULL if no item is due
+ */
+extern void *wheel_expire(wheel_t *w, int clock);
+
+/* Returns true if the wheel is empty
+ * @params:
+ *   w: wheel
+ * @returns:
+ *   1 if the wheel is empty and 0 otherwise
+ */
+extern int wheel_empty(wheel_t *w);
+
+/* Moves the time of an empty wheel back, so that items due before the last one taken out can be added
+ * @params:
+ *   w: empty wheel
+ *   now: new time of the wheel
+ * @returns:
+ *   none
+ */
+extern void wheel_rewind(wheel_t *w, int now);
+
+#endif //PROSIM_WHEEL_H